@@ -0,0 +1,98 @@
+#ifndef AABBH
+#define AABBH
+
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <algorithm>
+#include "vec3.h"
+#include "ray.h"
+
+/// Axis aligned bounding box, empty when min > max.
+typedef struct aabb
+{
+  vec3 min, max;
+  aabb(): min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+  aabb(const vec3 &a, const vec3 &b): min(a), max(b) {}
+
+  /// @brief Grow the box to contain point p.
+  inline void extend(const vec3 &p)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      min[a] = fminf(min[a], p[a]);
+      max[a] = fmaxf(max[a], p[a]);
+    }
+  }
+
+  /// @brief Grow the box to contain box b.
+  inline void extend(const aabb &b)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      min[a] = fminf(min[a], b.min[a]);
+      max[a] = fmaxf(max[a], b.max[a]);
+    }
+  }
+
+  inline vec3 center() const { return 0.5f * (min + max); }
+  inline vec3 extent() const { return max - min; }
+
+  /// @brief Axis of the largest extent.
+  inline int longest_axis() const
+  {
+    vec3 e = extent();
+    return e[0] > e[1] ? (e[0] > e[2] ? 0 : 2) : (e[1] > e[2] ? 1 : 2);
+  }
+
+  /// @brief Half the surface area, the quantity the SAH compares.
+  inline float half_area() const
+  {
+    vec3 e = extent();
+    if (e[0] < 0)
+    {
+      return 0;
+    }
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+  }
+
+  /// @brief Spread the low 10 bits of v to every third bit.
+  static inline uint32_t expand_bits(uint32_t v)
+  {
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+  }
+
+  /// @brief Quantize a point of the box to a 1024^3 grid and interleave
+  /// the bits, x highest, giving its position along a Z-order curve.
+  inline uint32_t morton_code(const vec3 &p) const
+  {
+    uint32_t q[3];
+    for (int a = 0; a < 3; a++)
+    {
+      float e = max[a] - min[a];
+      float f = e > 0 ? (p[a] - min[a]) / e : 0;
+      q[a] = std::min(1023u, uint32_t(f * 1024));
+    }
+    return (expand_bits(q[0]) << 2) | (expand_bits(q[1]) << 1) | expand_bits(q[2]);
+  }
+
+  /// @brief Slab test against a ray given as origin and reciprocal direction.
+  /// @return true iff the ray overlaps the box within (t_min, t_max).
+  inline bool hit(const vec3 &origin, const vec3 &inv_dir, float t_min, float t_max) const
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      float t0 = (min[a] - origin[a]) * inv_dir[a];
+      float t1 = (max[a] - origin[a]) * inv_dir[a];
+      t_min = fmaxf(t_min, fminf(t0, t1));
+      t_max = fminf(t_max, fmaxf(t0, t1));
+    }
+    return t_min <= t_max;
+  }
+} aabb;
+
+#endif
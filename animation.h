@@ -0,0 +1,232 @@
+#ifndef ANIMATIONH
+#define ANIMATIONH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <chrono>
+#include <future>
+#include <string>
+#include <sstream>
+#include "util.h"
+#include "keyframes.h"
+#include "scene.h"
+#include "scenes.h"
+#include "render.h"
+#include "output.h"
+#include "server.h"
+
+/// @brief Parse a keyframe "FRAME field=value ..." into camera or object keys.
+///
+/// A camera key has the view fields of the job protocol (from, at, up,
+/// fov); fields it leaves out are taken from the base job. An object key
+/// "FRAME obj=N center=X,Y,Z" places the center of sphere N of the scene's
+/// top-level objects.
+/// @return true iff the key was understood.
+bool parse_key(const char *arg, const render_job &base, view_track &camera, object_keys &objects,
+  std::string &err)
+{
+  char *rest;
+  long frame = strtol(arg, &rest, 10);
+  if (rest == arg)
+  {
+    err = std::string("key must start with a frame number: ") + arg;
+    return false;
+  }
+  if (!strstr(rest, "obj="))
+  {
+    render_job key = base;
+    if (!parse_job(rest, key, err))
+    {
+      return false;
+    }
+    camera.add(frame, key.frame.view);
+    return true;
+  }
+  std::istringstream is(rest);
+  std::string field;
+  long obj = -1;
+  vec3 center;
+  bool placed = false;
+  while (is >> field)
+  {
+    const char *val = field.c_str() + field.find('=') + 1;
+    char *end;
+    if (field.compare(0, 4, "obj=") == 0)
+    {
+      obj = strtol(val, &end, 10);
+      if (end == val || *end != '\0' || obj < 0 || obj > INT_MAX)
+      {
+        err = "bad object index " + field;
+        return false;
+      }
+    } else if (field.compare(0, 7, "center=") == 0 && parse_vec3(val, center))
+    {
+      placed = true;
+    } else
+    {
+      err = "object keys take obj=N center=X,Y,Z, not " + field;
+      return false;
+    }
+  }
+  if (!placed)
+  {
+    err = "object key without center=X,Y,Z";
+    return false;
+  }
+  objects[obj].add(frame, center);
+  return true;
+}
+
+/// @brief Attach object keys to the top-level spheres of a freshly built scene.
+/// @return false if a key names an object that is not a sphere.
+bool attach_keys(scene *scn, const object_keys &objects, std::string &err)
+{
+  for (object_keys::const_iterator it = objects.begin(); it != objects.end(); it++)
+  {
+    sphere *s = it->first < scn->world->size() ? dynamic_cast<sphere *>(scn->world->get(it->first)) : NULL;
+    if (!s)
+    {
+      err = "object " + std::to_string(it->first) + " is not a top-level sphere of the scene";
+      return false;
+    }
+    scn->motion.push_back(object_track{s, it->second});
+  }
+  return true;
+}
+
+/// @brief Output path of frame k. If out contains '%' it must hold exactly
+/// one %d or %0Nd, replaced by k, and otherwise only %% for a literal '%';
+/// without '%', "_%04d" is inserted before the extension.
+/// @param name (OUT) path of the frame
+/// @return false if out is not a valid pattern.
+bool frame_filename(const std::string &out, int k, std::string &name)
+{
+  char digits[32];
+  if (out.find('%') == std::string::npos)
+  {
+    size_t dot = out.rfind('.');
+    snprintf(digits, sizeof(digits), "_%04d", k);
+    name = dot == std::string::npos ? out + digits : out.substr(0, dot) + digits + out.substr(dot);
+    return true;
+  }
+  /// Substituted by hand: out is user input and never reaches printf as a format.
+  name.clear();
+  bool numbered = false;
+  for (size_t p = 0; p < out.size(); p++)
+  {
+    if (out[p] != '%')
+    {
+      name += out[p];
+      continue;
+    }
+    if (p + 1 < out.size() && out[p + 1] == '%')
+    {
+      name += '%';
+      p++;
+      continue;
+    }
+    size_t q = p + 1;
+    int width = 0;
+    if (q < out.size() && out[q] == '0')
+    {
+      while (++q < out.size() && isdigit((unsigned char) out[q]) && width < 100)
+      {
+        width = width * 10 + (out[q] - '0');
+      }
+    }
+    if (numbered || q >= out.size() || out[q] != 'd' || width >= 100)
+    {
+      return false;
+    }
+    snprintf(digits, sizeof(digits), "%0*d", width, k);
+    name += digits;
+    numbered = true;
+    p = q;
+  }
+  return numbered;
+}
+
+/// @brief Render frames first..last of an animation.
+///
+/// Two copies of the scene are kept. While one renders frame k, a second
+/// thread moves the other copy to frame k + 1 (keyframed objects, bvh
+/// refit, camera), and finished frames are encoded by an async_writer, so
+/// neither setup nor output stalls the render pool.
+/// @param job scene, environment, output pattern and base frame
+/// @param camera camera keyframes, the job's view when empty
+/// @param objects keyed sphere centers, on top of the scene's own rig
+/// @return 0 on success, 1 on error.
+int render_animation(const render_job &job, int first, int last, const view_track &camera,
+  const object_keys &objects)
+{
+  std::string name;
+  if (!frame_filename(job.out, first, name))
+  {
+    cerr << "Bad output pattern " << job.out << ": use one %d or %0Nd, and %% for '%'\n";
+    return 1;
+  }
+  scene *scn[2] = {NULL, NULL};
+  for (int b = 0; b < 2; b++)
+  {
+    std::string err;
+    scn[b] = build_scene(job.scene.c_str(), job.frame, job.texture);
+    if (!scn[b])
+    {
+      cerr << "Unknown scene " << job.scene << "\n";
+      delete scn[0];
+      return 1;
+    }
+    if ((!job.env.empty() && !scn[b]->load_environment(job.env, err)) || !attach_keys(scn[b], objects, err))
+    {
+      cerr << err << "\n";
+      delete scn[0];
+      delete scn[1];
+      return 1;
+    }
+  }
+  frame_ctx frames[2] = {job.frame, job.frame};
+  /// Move buffer b to frame k, returns the time it took in milliseconds.
+  auto prepare = [&](int b, int k) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    frames[b].view = camera.at(k, job.frame.view);
+    setup_camera(frames[b]);
+    scn[b]->set_time(k, frames[b].shutter);
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+    return took.count();
+  };
+  prepare(0, first);
+
+  async_writer writer;
+  vec3 **image = allocate_image(job.frame);
+  for (int k = first; k <= last; k++)
+  {
+    int cur = (k - first) & 1;
+    std::future<double> next;
+    if (k < last)
+    {
+      next = std::async(std::launch::async, prepare, 1 - cur, k + 1);
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    render_image(scn[cur], frames[cur], image);
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+    frame_filename(job.out, k, name);
+    writer.submit(name, capture_image(image, frames[cur]));
+    fprintf(stderr, "frame %d -> %s: render %.0f ms", k, name.c_str(), took.count());
+    if (k < last)
+    {
+      fprintf(stderr, ", next frame setup %.3f ms (overlapped)", next.get());
+    }
+    fprintf(stderr, "\n");
+  }
+  destroy_image(image, job.frame);
+  int failures = writer.close();
+  report_scene(scn[0]);
+  delete scn[0];
+  delete scn[1];
+  return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef ARENAH
+#define ARENAH
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#define ARENA_BLOCK (1 << 20) /// Bytes of each arena block, unless one allocation needs more
+#define ARENA_ALIGN 16        /// Alignment of every arena allocation
+
+/// Scratch arena class
+/// Bump allocator for per-sample and per-row scratch data of one thread.
+/// Allocations are never freed one by one: a scope records a mark and
+/// releases everything allocated after it at once. Blocks are kept for the
+/// next scope, so once an arena has grown to a workload's high water mark
+/// it serves it without calling the heap allocator.
+class scratch_arena
+{
+  public:
+    scratch_arena(): current(0), used(0), peak(0) {}
+
+    /// Position to release back to, see arena_scope.
+    typedef struct mark_t
+    {
+      size_t block, used;
+    } mark_t;
+
+    /// @brief Uninitialized storage for n objects of type T, which must
+    /// not need destruction: releases never run destructors.
+    template <class T>
+    T *alloc(size_t n)
+    {
+      static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+      static_assert(alignof(T) <= ARENA_ALIGN, "arena alignment too small");
+      return (T *) bytes(n * sizeof(T));
+    }
+
+    /// @brief Storage for n objects of type T, each set to value.
+    template <class T>
+    T *alloc(size_t n, const T &value)
+    {
+      T *p = alloc<T>(n);
+      for (size_t k = 0; k < n; k++)
+      {
+        new (p + k) T(value);
+      }
+      return p;
+    }
+
+    inline mark_t mark() const { return mark_t{current, used}; }
+
+    /// @brief Free everything allocated since m.
+    inline void release(const mark_t &m)
+    {
+      current = m.block;
+      used = m.used;
+    }
+
+    /// @brief Bytes held in blocks, used or not.
+    size_t capacity() const
+    {
+      size_t total = 0;
+      for (size_t b = 0; b < blocks.size(); b++)
+      {
+        total += blocks[b].size;
+      }
+      return total;
+    }
+    /// @brief Most bytes in use at once, counting from the first block.
+    inline size_t high_water() const { return peak; }
+
+  private:
+    typedef struct block_t
+    {
+      std::unique_ptr<char[]> data;
+      size_t size;
+    } block_t;
+
+    void *bytes(size_t n)
+    {
+      n = (n + ARENA_ALIGN - 1) & ~size_t(ARENA_ALIGN - 1);
+      /// Move on to the next block that fits, adding one if none does.
+      while (current < blocks.size() && used + n > blocks[current].size)
+      {
+        current++;
+        used = 0;
+      }
+      if (current == blocks.size())
+      {
+        size_t size = std::max<size_t>(ARENA_BLOCK, n);
+        /// new[] of char only guarantees fundamental alignment, enough for 16.
+        blocks.push_back(block_t{std::unique_ptr<char[]>(new char[size]), size});
+      }
+      void *p = blocks[current].data.get() + used;
+      used += n;
+      size_t in_use = used;
+      for (size_t b = 0; b < current; b++)
+      {
+        in_use += blocks[b].size;
+      }
+      peak = std::max(peak, in_use);
+      return p;
+    }
+
+    std::vector<block_t> blocks;
+    size_t current;  /* Block allocations are taken from. */
+    size_t used;     /* Bytes used in the current block. */
+    size_t peak;     /* High water mark in bytes. */
+};
+
+/// @brief Arena of the calling thread.
+inline scratch_arena &thread_arena()
+{
+  static thread_local scratch_arena arena;
+  return arena;
+}
+
+/// Releases what was allocated from an arena during its lifetime, like a
+/// stack frame. Scopes nest; the innermost must end first.
+class arena_scope
+{
+  public:
+    arena_scope(scratch_arena &a = thread_arena()): arena(a), start(a.mark()) {}
+    ~arena_scope() { arena.release(start); }
+    arena_scope(const arena_scope &) = delete;
+    arena_scope &operator=(const arena_scope &) = delete;
+
+  private:
+    scratch_arena &arena;
+    scratch_arena::mark_t start;
+};
+
+#endif
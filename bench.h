@@ -0,0 +1,462 @@
+#ifndef BENCHH
+#define BENCHH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "vec3.h"
+#include "ray.h"
+#include "rng.h"
+#include "hitable.h"
+#include "materials.h"
+#include "util.h"
+#include "render.h"
+#include "scenes.h"
+#include "bvh.h"
+#include "grid.h"
+
+#define BENCH_ITERATIONS 2000000
+
+#ifdef BENCH_ALLOCATIONS
+/// Calls of the global operator new, counted to check that hot loops stay
+/// off the heap. Only the benchmark build (make bench) replaces the
+/// allocator; renders and the daemon use the library one.
+static std::atomic<uint64_t> heap_allocations(0);
+
+/// Counting replacements of the global allocation functions. new[] and
+/// the nothrow forms forward to these. Kept out of line, with their
+/// deletes, so the compiler sees matching pairs.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new(size_t size, std::align_val_t align)
+{
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  size_t a = std::max(size_t(align), sizeof(void *));
+  if (void *p = aligned_alloc(a, (size + a - 1) / a * a))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+#endif
+
+/// Sink for benchmark results, keeps the compiler from dropping the work.
+static volatile float bench_sink;
+
+/// @brief Average wall time of op(k) over n calls, in nanoseconds.
+template <class F>
+double bench_ns(F op, size_t n)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t k = 0; k < n; k++)
+  {
+    op(k);
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / n;
+}
+
+/// @brief Print one benchmark line.
+void bench_report(const char *name, double ns, const char *note = "")
+{
+  printf("  %-34s %9.1f ns/op %12.0f ops/s  %s\n", name, ns, 1e9 / ns, note);
+}
+
+/// @brief Rejection sampled point in the unit ball, as the renderer used to do it.
+/// Kept only as the baseline for the sampling benchmarks.
+vec3 rejection_in_unit_ball()
+{
+  vec3 res;
+  do
+  {
+    res = 2 * vec3(random_float(),random_float(),random_float()) - vec3(1,1,1);
+  } while (res.squared_length() >= 1.0);
+  return res;
+}
+
+/// @brief Sampling routines and material bounces, before and after
+/// closed-form sampling.
+void bench_sampling()
+{
+  const size_t n = BENCH_ITERATIONS;
+  printf("sampling\n");
+  /// Every op starts a fresh stream, as a bounce of a new path would.
+  uint32_t draws = 0;
+  double ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    bench_sink = rejection_in_unit_ball().x();
+    draws += thread_rng().dim;
+  }, n);
+  char note[64];
+  snprintf(note, sizeof(note), "%.2f draws/op", double(draws) / n);
+  bench_report("ball, rejection (before)", ns, note);
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    bench_sink = random_in_unit_sphere().x();
+  }, n);
+  bench_report("ball, closed form", ns, "3.00 draws/op");
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    bench_sink = sample_unit_sphere(random_float(), random_float()).x();
+  }, n);
+  bench_report("sphere surface", ns);
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    bench_sink = sample_unit_disk(random_float(), random_float()).x();
+  }, n);
+  bench_report("disk", ns);
+
+  printf("bounce\n");
+  hit_record rec;
+  rec.t = 1;
+  rec.p = vec3(0, 0, -1);
+  rec.normal = unit_vector(vec3(0.3, 1, 0.2));
+  ray r_in(vec3(0, 0, 0), vec3(0, -0.2, -1));
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    vec3 target = rec.p + rec.normal + rejection_in_unit_ball();
+    ray scattered(rec.p, target - rec.p);
+    bench_sink = scattered.direction().x();
+  }, n);
+  bench_report("lambertian, rejection (before)", ns);
+  lambertian diffuse(RED);
+  metal fuzzy(SKYBLUE, 0.3);
+  vec3 attenuation;
+  ray scattered;
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    diffuse.scatter(r_in, rec, attenuation, scattered);
+    bench_sink = scattered.direction().x();
+  }, n);
+  bench_report("lambertian, cosine hemisphere", ns);
+  ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    fuzzy.scatter(r_in, rec, attenuation, scattered);
+    bench_sink = scattered.direction().x();
+  }, n);
+  bench_report("fuzzy metal", ns);
+}
+
+/// @brief Camera samples per second for the default scene, single threaded.
+void bench_render(const frame_ctx &frame)
+{
+  printf("render\n");
+  scene *scn = build_scene("default", frame);
+  const int n = 200000;
+  double ns = bench_ns([&](size_t k) {
+    int i = k % frame.nX;
+    int j = (k / frame.nX) % frame.nY;
+    bench_sink = sample_pixel(scn, frame, i, j, k).x();
+  }, n);
+  bench_report("default scene, camera sample", ns);
+  delete scn;
+}
+
+/// @brief The default scene as a hit_list of heap spheres and as a
+/// static_world: closest hits and camera samples, single threaded.
+void bench_static(const frame_ctx &frame)
+{
+  printf("static world, default scene\n");
+  std::vector<ray> rays(1024);
+  for (size_t k = 0; k < rays.size(); k++)
+  {
+    int i = k % frame.nX, j = (k * 7) % frame.nY;
+    rays[k] = camera_ray(frame, i, j, k);
+  }
+  static const char *names[2] = {"default", "fixed"};
+  for (int s = 0; s < 2; s++)
+  {
+    scene *scn = build_scene(names[s], frame);
+    size_t hits = 0;
+    double ns = bench_ns([&](size_t k) {
+      hit_record rec;
+      hits += scn->world->hit(rays[k & 1023], 0.0001, MAXFLOAT, rec);
+    }, BENCH_ITERATIONS);
+    char name[64];
+    snprintf(name, sizeof(name), "%s, closest hit", names[s]);
+    bench_report(name, ns);
+    ns = bench_ns([&](size_t k) {
+      int i = k % frame.nX;
+      int j = (k / frame.nX) % frame.nY;
+      bench_sink = sample_pixel(scn, frame, i, j, k).x();
+    }, 200000);
+    snprintf(name, sizeof(name), "%s, camera sample", names[s]);
+    bench_report(name, ns);
+    delete scn;
+  }
+}
+
+/// @brief Camera samples of the motion scene with a closed and an open
+/// shutter: the price of time sampling and of bounds covering the motion.
+void bench_motion(const frame_ctx &frame)
+{
+  printf("motion blur, motion scene\n");
+  for (int open = 0; open < 2; open++)
+  {
+    frame_ctx f = frame;
+    f.shutter = open;
+    scene *scn = build_scene("motion", f);
+    double ns = bench_ns([&](size_t k) {
+      int i = k % f.nX;
+      int j = (k / f.nX) % f.nY;
+      bench_sink = sample_pixel(scn, f, i, j, k).x();
+    }, 200000);
+    bench_report(open ? "shutter open, camera sample" : "static, camera sample", ns);
+    delete scn;
+  }
+}
+
+/// @brief Shadow rays against the lights scene: closest hit versus any hit.
+void bench_shadow(const frame_ctx &frame)
+{
+  printf("shadow rays\n");
+  scene *scn = build_scene("lights", frame);
+  const size_t n = BENCH_ITERATIONS / 4;
+  /// Rays from above the ground plane towards random points of the scene.
+  std::vector<ray> rays(1024);
+  for (size_t k = 0; k < rays.size(); k++)
+  {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    vec3 from = vec3(4 * random_float() - 2, 2 * random_float(), -3 * random_float());
+    vec3 to = vec3(4 * random_float() - 2, 2 * random_float(), -3 * random_float());
+    rays[k] = ray(from, to - from);
+  }
+  size_t blocked = 0;
+  double ns = bench_ns([&](size_t k) {
+    hit_record rec;
+    blocked += scn->world->hit(rays[k & 1023], 0.0001, 1, rec);
+  }, n);
+  bench_report("closest hit", ns);
+  ns = bench_ns([&](size_t k) {
+    blocked += scn->world->occluded(rays[k & 1023], 0.0001, 1);
+  }, n);
+  char note[64];
+  snprintf(note, sizeof(note), "%.0f%% blocked", 50.0 * blocked / n);
+  bench_report("any hit (occluded)", ns, note);
+  delete scn;
+}
+
+/// @brief Closest hit against a dense grid of spheres, where most candidate
+/// hits are later replaced by a closer one.
+void bench_dense()
+{
+  printf("dense scene\n");
+  hit_list world;
+  for (int z = 0; z < 16; z++)
+  {
+    for (int x = 0; x < 16; x++)
+    {
+      world.push(new sphere(vec3(x - 7.5f, 0, -2 - z), 0.45, new lambertian(RED)));
+    }
+  }
+  const size_t n = BENCH_ITERATIONS / 20;
+  size_t hits = 0;
+  double ns = bench_ns([&](size_t k) {
+    seed_sample(NULL, 1, 0, k, 0, 0);
+    vec3 from = vec3(8 * random_float() - 4, 0.2f * random_float(), 1);
+    ray r(from, vec3(0, 0, -1));
+    hit_record rec;
+    hits += world.hit(r, 0.0001, MAXFLOAT, rec);
+  }, n);
+  char note[64];
+  snprintf(note, sizeof(note), "256 spheres, %.0f%% hit", 100.0 * hits / n);
+  bench_report("closest hit", ns, note);
+}
+
+#define BENCH_BVH_SPHERES (1 << 18)
+
+/// @brief Build a bvh over random spheres with every method and trace
+/// random rays through each.
+void bench_bvh()
+{
+  printf("bvh, %d spheres\n", BENCH_BVH_SPHERES);
+  std::vector<ray> rays(4096);
+  for (size_t k = 0; k < rays.size(); k++)
+  {
+    seed_sample(NULL, 1, 1, k, 0, 0);
+    vec3 from = vec3(120 * random_float() - 60, 120 * random_float() - 60, 60);
+    vec3 to = vec3(100 * random_float() - 50, 100 * random_float() - 50, -50);
+    rays[k] = ray(from, to - from);
+  }
+  for (int m = 0; m < BVH_METHODS; m++)
+  {
+    std::vector<hitable *> spheres(BENCH_BVH_SPHERES);
+    for (size_t k = 0; k < spheres.size(); k++)
+    {
+      seed_sample(NULL, 1, 2, k, 0, 0);
+      vec3 c = vec3(100 * random_float() - 50, 100 * random_float() - 50, 100 * random_float() - 50);
+      spheres[k] = new sphere(c, 0.1 + 0.4 * random_float(), new lambertian(RED));
+    }
+    bvh tree(spheres, m);
+    const bvh_stats &st = tree.stats();
+    size_t hits = 0;
+    double ns = bench_ns([&](size_t k) {
+      hit_record rec;
+      hits += tree.hit(rays[k & 4095], 0.0001, MAXFLOAT, rec);
+    }, 200000);
+    char name[64], note[96];
+    snprintf(name, sizeof(name), "%s closest hit", bvh_names[m]);
+    snprintf(note, sizeof(note), "build %.1f ms, SAH cost %.1f, depth %d",
+      st.build_ms, st.sah_cost, st.depth);
+    bench_report(name, ns, note);
+    ns = bench_ns([&](size_t k) {
+      hit_record rec;
+      hits += tree.hit_binary(rays[k & 4095], 0.0001, MAXFLOAT, rec);
+    }, 200000);
+    snprintf(name, sizeof(name), "%s closest hit, binary", bvh_names[m]);
+    snprintf(note, sizeof(note), "%zu nodes, %zu 4-wide", st.nodes, st.wide_nodes);
+    bench_report(name, ns, note);
+    /// Same tree in the other wide node layout.
+    double mb = st.wide_bytes / 1048576.0;
+    tree.set_quantized(!st.quantized);
+    ns = bench_ns([&](size_t k) {
+      hit_record rec;
+      hits += tree.hit(rays[k & 4095], 0.0001, MAXFLOAT, rec);
+    }, 200000);
+    snprintf(name, sizeof(name), "%s closest hit, %s", bvh_names[m], st.quantized ? "quantized" : "float");
+    snprintf(note, sizeof(note), "4-wide nodes %.1f MB, %s %.1f MB",
+      st.wide_bytes / 1048576.0, st.quantized ? "float" : "quantized", mb);
+    bench_report(name, ns, note);
+  }
+}
+
+/// @brief Trace the rays of bench_bvh through a uniform grid over the same
+/// evenly spread spheres.
+void bench_grid()
+{
+  printf("grid, %d spheres\n", BENCH_BVH_SPHERES);
+  std::vector<ray> rays(4096);
+  for (size_t k = 0; k < rays.size(); k++)
+  {
+    seed_sample(NULL, 1, 1, k, 0, 0);
+    vec3 from = vec3(120 * random_float() - 60, 120 * random_float() - 60, 60);
+    vec3 to = vec3(100 * random_float() - 50, 100 * random_float() - 50, -50);
+    rays[k] = ray(from, to - from);
+  }
+  std::vector<hitable *> spheres(BENCH_BVH_SPHERES);
+  for (size_t k = 0; k < spheres.size(); k++)
+  {
+    seed_sample(NULL, 1, 2, k, 0, 0);
+    vec3 c = vec3(100 * random_float() - 50, 100 * random_float() - 50, 100 * random_float() - 50);
+    spheres[k] = new sphere(c, 0.1 + 0.4 * random_float(), new lambertian(RED));
+  }
+  grid cells(spheres);
+  const grid_stats &st = cells.stats();
+  size_t hits = 0;
+  double ns = bench_ns([&](size_t k) {
+    hit_record rec;
+    hits += cells.hit(rays[k & 4095], 0.0001, MAXFLOAT, rec);
+  }, 200000);
+  char note[96];
+  snprintf(note, sizeof(note), "build %.1f ms, %dx%dx%d cells, %.1f MB",
+    st.build_ms, st.res[0], st.res[1], st.res[2], st.bytes / 1048576.0);
+  bench_report("closest hit", ns, note);
+}
+
+/// @brief Camera samples per second of the particles scene with bounces
+/// traced path by path and in sorted batches.
+void bench_sort_rays(const frame_ctx &frame)
+{
+  printf("ray sorting, particles scene\n");
+  scene *scn = build_scene("particles", frame);
+  frame_ctx f = frame;
+  f.nS = 16;
+  std::vector<vec3> row(f.nX);
+  const int rows = 8;
+  bool keep = sort_rays;
+  for (int sorted = 0; sorted < 2; sorted++)
+  {
+    sort_rays = sorted;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int j = 0; j < rows; j++)
+    {
+      render_row(scn, f, f.nY / 2 - rows / 2 + j, 0, f.nX, row.data());
+    }
+    std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    bench_report(sorted ? "sorted batches" : "path by path", took.count() / (rows * f.nX * f.nS),
+      "per camera sample");
+  }
+  sort_rays = keep;
+  delete scn;
+}
+
+/// @brief Heap allocations while rendering, which should come only from
+/// per-row task overhead and never from tracing samples.
+void bench_allocations(const frame_ctx &frame)
+{
+  printf("heap allocations\n");
+#ifndef BENCH_ALLOCATIONS
+  printf("  not counted, build with make bench\n");
+#else
+  static const char *names[2] = {"default", "particles"};
+  frame_ctx f = frame;
+  f.nS = 4;
+  std::vector<vec3> row(f.nX);
+  const int rows = 8;
+  bool keep = sort_rays;
+  for (int s = 0; s < 2; s++)
+  {
+    scene *scn = build_scene(names[s], f);
+    for (int sorted = 0; sorted < 2; sorted++)
+    {
+      sort_rays = sorted;
+      /// The first row grows the arena to its high water mark.
+      render_row(scn, f, 0, 0, f.nX, row.data());
+      uint64_t before = heap_allocations.load();
+      for (int j = 0; j < rows; j++)
+      {
+        render_row(scn, f, f.nY / 2 - rows / 2 + j, 0, f.nX, row.data());
+      }
+      uint64_t calls = heap_allocations.load() - before;
+      char name[64], note[96];
+      snprintf(name, sizeof(name), "%s, %s", names[s], sorted ? "sorted batches" : "path by path");
+      snprintf(note, sizeof(note), "%llu allocations in %d camera samples, arena %.1f KB",
+        (unsigned long long) calls, int(rows * f.nX * f.nS), thread_arena().high_water() / 1024.0);
+      printf("  %-34s %s\n", name, note);
+    }
+    vec3 **image = allocate_image(f);
+    uint64_t before = heap_allocations.load();
+    render_image(scn, f, image);
+    uint64_t calls = heap_allocations.load() - before;
+    printf("  %-34s %.2f allocations per row (task queue)\n", "whole frame", double(calls) / f.nY);
+    destroy_image(image, f);
+    delete scn;
+  }
+  sort_rays = keep;
+#endif
+}
+
+/// @brief Run the benchmark suite and print results to stdout.
+int run_benchmarks(const frame_ctx &frame)
+{
+  bench_sampling();
+  bench_render(frame);
+  bench_static(frame);
+  bench_motion(frame);
+  bench_shadow(frame);
+  bench_dense();
+  bench_bvh();
+  bench_grid();
+  bench_sort_rays(frame);
+  bench_allocations(frame);
+  return 0;
+}
+
+#endif
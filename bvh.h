@@ -0,0 +1,943 @@
+#ifndef BVHH
+#define BVHH
+
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <emmintrin.h>
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+#include "arena.h"
+
+#define BVH_LEAF_SIZE 2       /// Leaf size of median and LBVH builds
+#define BVH_MAX_LEAF 8        /// Largest leaf the SAH builder may keep
+#define BVH_BINS 16           /// SAH split candidates per node
+#define BVH_PARALLEL_MIN 4096 /// Smallest subtree built on its own thread
+#define BVH_MAX_DEPTH 48      /// Deeper nodes fall back to median splits
+#define BVH_STACK 64          /// Traversal stack depth kept on the C++ stack
+#define BVH_WIDTH 4           /// Children per node of the collapsed tree
+#define BVH_WIDE_STACK (BVH_STACK * (BVH_WIDTH - 1))
+
+/// BVH construction methods.
+enum bvh_method
+{
+  BVH_SAH = 0,  /// Binned surface area heuristic, best trees
+  BVH_LBVH,     /// Morton code radix splits, fastest build for dynamic scenes
+  BVH_MEDIAN,   /// Object median on the longest axis
+  BVH_METHODS
+};
+
+static const char *bvh_names[BVH_METHODS] = {"sah", "lbvh", "median"};
+
+/// Construction method of every bvh built without an explicit one.
+/// Set from the command line before scenes are built.
+static int bvh_default = BVH_SAH;
+
+/// Store wide node bounds quantized to 8 bits, see bvh::set_quantized.
+/// Set from the command line before scenes are built.
+static bool bvh_quantize = false;
+
+/// @brief Look up a construction method by name.
+/// @return bvh_method, or -1 if the name is unknown.
+int parse_bvh(const char *name)
+{
+  for (int m = 0; m < BVH_METHODS; m++)
+  {
+    if (strcmp(bvh_names[m], name) == 0)
+    {
+      return m;
+    }
+  }
+  return -1;
+}
+
+/// Build statistics, see bvh::stats.
+typedef struct bvh_stats
+{
+  int method;
+  double build_ms;  /// Wall time of the build
+  float sah_cost;   /// Expected cost of a random ray, in node traversals
+  size_t nodes, leaves;
+  int depth;
+  size_t wide_nodes;  /// Nodes of the collapsed 4-wide tree
+  bool quantized;     /// Wide nodes use 8 bit bounds
+  size_t wide_bytes;  /// Memory of the wide nodes in the current layout
+} bvh_stats;
+
+/// Pending child of a wide traversal and its entry distance.
+typedef struct wide_entry
+{
+  int child;
+  float t;
+} wide_entry;
+
+/// Traversal stack of a bvh query. Up to N entries live in the object
+/// itself; deeper trees, which only degenerate inputs produce, take their
+/// stack from the thread's scratch arena instead of overflowing.
+template <class T, size_t N>
+class traversal_stack
+{
+  public:
+    /// @param need most entries the traversal can push
+    traversal_stack(size_t need): data(local), arena(NULL)
+    {
+      if (need > N)
+      {
+        arena = &thread_arena();
+        start = arena->mark();
+        data = arena->alloc<T>(need);
+      }
+    }
+    ~traversal_stack()
+    {
+      if (arena)
+      {
+        arena->release(start);
+      }
+    }
+    traversal_stack(const traversal_stack &) = delete;
+    traversal_stack &operator=(const traversal_stack &) = delete;
+
+    T *data;
+
+  private:
+    T local[N];
+    scratch_arena *arena;         /* Arena holding data, NULL if local. */
+    scratch_arena::mark_t start;  /* Arena position to release to. */
+};
+
+/// Bounding volume hierarchy class
+/// Owns a set of hitables and answers ray queries in logarithmic time. Nodes
+/// are stored depth first in one array: an interior node's left child
+/// follows it directly, the right child's index is stored in the node.
+/// After building, the binary tree is collapsed into a 4-wide tree whose
+/// child boxes are tested against a ray in one SSE sequence; queries run
+/// on the wide tree, the binary one is kept for refits and as reference.
+/// Quantized, the wide nodes shrink from two cache lines to one.
+class bvh : public hitable
+{
+  public:
+    /// @brief Build over heap allocated objects, which the BVH then owns.
+    /// @param method bvh_method, bvh_default if not given
+    bvh(const std::vector<hitable *> &objects, int method = bvh_default): prims(objects)
+    {
+      build(method);
+      set_quantized(bvh_quantize);
+    }
+    virtual ~bvh()
+    {
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        delete prims[i];
+      }
+    }
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    virtual bool occluded(const ray &r, float t_min, float t_max) const;
+    /// @brief Closest hit walking the binary tree, for comparison.
+    bool hit_binary(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    /// Objects finalize their own hits, rec.obj never points at the BVH.
+    virtual void finalize(const ray &r, hit_record &rec) const { rec.obj->finalize(r, rec); }
+    virtual bool bounding_box(aabb &box) const
+    {
+      if (nodes.empty())
+      {
+        return false;
+      }
+      box = nodes[0].box;
+      return true;
+    }
+
+    inline size_t size() const { return prims.size(); }
+    inline hitable *get(size_t i) const { return prims[i]; }
+    inline const bvh_stats &stats() const { return build_stats; }
+
+    /// @brief Switch the wide nodes between float and 8 bit bounds.
+    ///
+    /// Quantized child bounds are stored relative to the union of the
+    /// children and rounded outwards, so traversal visits a superset of the
+    /// nodes the float layout would and finds the same hits.
+    void set_quantized(bool on)
+    {
+      qwide.clear();
+      qsrc.clear();
+      if (on && !wide.empty())
+      {
+        qwide.resize(wide.size());
+        qsrc.resize(wide.size() * BVH_WIDTH);
+        for (size_t w = 0; w < wide.size(); w++)
+        {
+          std::copy(wide[w].src, wide[w].src + BVH_WIDTH, &qsrc[w * BVH_WIDTH]);
+          std::copy(wide[w].child, wide[w].child + BVH_WIDTH, qwide[w].child);
+          quantize(w);
+        }
+        std::vector<wide_node>().swap(wide);
+      } else if (!on && wide.empty() && !nodes.empty())
+      {
+        int root = 0;
+        collapse(&root, 1);
+      }
+      build_stats.quantized = !qwide.empty();
+      build_stats.wide_bytes = build_stats.quantized ?
+        qwide.size() * sizeof(quantized_node) : wide.size() * sizeof(wide_node);
+    }
+
+    /// @brief Recompute every box bottom up after objects moved.
+    ///
+    /// Keeps the tree topology, which stays efficient as long as objects
+    /// move coherently, and costs a fraction of a rebuild.
+    void refit()
+    {
+      /// Children always come after their parent.
+      for (size_t k = nodes.size(); k-- > 0;)
+      {
+        bvh_node &n = nodes[k];
+        aabb box;
+        if (n.count > 0)
+        {
+          for (int i = n.offset; i < n.offset + n.count; i++)
+          {
+            aabb pb;
+            prims[i]->bounding_box(pb);
+            box.extend(pb);
+          }
+        } else
+        {
+          box.extend(nodes[k + 1].box);
+          box.extend(nodes[n.offset].box);
+        }
+        n.box = box;
+      }
+      for (size_t w = 0; w < wide.size(); w++)
+      {
+        for (int c = 0; c < BVH_WIDTH; c++)
+        {
+          if (wide[w].src[c] >= 0)
+          {
+            wide[w].set_box(c, nodes[wide[w].src[c]].box);
+          }
+        }
+      }
+      for (size_t w = 0; w < qwide.size(); w++)
+      {
+        quantize(w);
+      }
+      build_stats.sah_cost = sah_cost();
+    }
+    inline size_t node_count() const { return nodes.size(); }
+
+  private:
+    typedef struct bvh_node
+    {
+      aabb box;
+      int offset;  /// Leaf: first primitive; interior: right child
+      int count;   /// Primitives in a leaf, 0 for interior nodes, -1 unused
+      int axis;    /// Split axis, decides the visiting order
+    } bvh_node;
+
+    /// Node of the collapsed tree, child boxes stored per axis so that four
+    /// slab tests run side by side.
+    typedef struct alignas(16) wide_node
+    {
+      float lo[3][BVH_WIDTH], hi[3][BVH_WIDTH];
+      int child[BVH_WIDTH];  /// Wide node index, or wide_leaf(offset, count)
+      int src[BVH_WIDTH];    /// Binary node of each child, -1 for empty lanes
+
+      void set_box(int c, const aabb &box)
+      {
+        for (int a = 0; a < 3; a++)
+        {
+          lo[a][c] = box.min[a];
+          hi[a][c] = box.max[a];
+        }
+      }
+    } wide_node;
+
+    /// Wide node with child bounds as 8 bit steps from the origin of the
+    /// node, one cache line instead of two. Empty lanes have child 0, the
+    /// root, which is never anyone's child.
+    typedef struct alignas(64) quantized_node
+    {
+      float origin[3], step[3];
+      uint8_t lo[3][BVH_WIDTH], hi[3][BVH_WIDTH];
+      int child[BVH_WIDTH];
+    } quantized_node;
+
+    /// Leaves are encoded as negative children; counts stay below 16.
+    static inline int wide_leaf(int offset, int count) { return -1 - (offset << 4 | count); }
+    static inline int leaf_offset(int child) { return (-1 - child) >> 4; }
+    static inline int leaf_count(int child) { return (-1 - child) & 15; }
+
+    typedef struct build_prim
+    {
+      aabb box;
+      vec3 center;
+      uint32_t code;  /// Morton code of the center, LBVH only
+      hitable *obj;
+    } build_prim;
+
+    /// Range of primitives and the node slots reserved for its subtree.
+    typedef struct build_task
+    {
+      size_t begin, end;
+      size_t slot;  /// Node index; a subtree over m primitives owns 2m - 1 slots
+      int depth;
+    } build_task;
+
+    void build(int method)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::vector<build_prim> bp(prims.size());
+      aabb centers;
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        prims[i]->bounding_box(bp[i].box);
+        bp[i].center = bp[i].box.center();
+        bp[i].obj = prims[i];
+        centers.extend(bp[i].center);
+      }
+      if (method == BVH_LBVH)
+      {
+        assign_morton_codes(bp, centers);
+      }
+      /// Subtrees write to disjoint, precomputed slots, so they can be
+      /// built concurrently. Unused slots are squeezed out afterwards.
+      bvh_node unused;
+      unused.count = -1;
+      nodes.assign(bp.empty() ? 0 : 2 * bp.size() - 1, unused);
+      int spawn_depth = 0;
+      for (unsigned t = std::thread::hardware_concurrency(); t > 1; t >>= 1)
+      {
+        spawn_depth++;
+      }
+      if (!bp.empty())
+      {
+        build_subtree(bp, build_task{0, bp.size(), 0, 0}, method, spawn_depth + 2);
+      }
+      compact();
+      wide.clear();
+      if (!nodes.empty())
+      {
+        int root = 0;
+        collapse(&root, 1);
+      }
+      for (size_t i = 0; i < bp.size(); i++)
+      {
+        prims[i] = bp[i].obj;
+      }
+      std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+      build_stats.method = method;
+      build_stats.build_ms = took.count();
+      build_stats.sah_cost = sah_cost();
+    }
+
+    /// @brief Build the subtree of task t, handing its left half to another
+    /// thread while spawn levels remain and the half is large enough.
+    void build_subtree(std::vector<build_prim> &bp, build_task t, int method, int spawn)
+    {
+      for (;;)
+      {
+        size_t mid = split_node(bp, t, method);
+        if (mid == t.end)
+        {
+          return;
+        }
+        build_task left{t.begin, mid, t.slot + 1, t.depth + 1};
+        build_task right{mid, t.end, t.slot + 2 * (mid - t.begin), t.depth + 1};
+        if (spawn > 0 && mid - t.begin >= BVH_PARALLEL_MIN)
+        {
+          std::future<void> job = std::async(std::launch::async,
+            [this, &bp, left, method, spawn] { build_subtree(bp, left, method, spawn - 1); });
+          build_subtree(bp, right, method, spawn - 1);
+          job.get();
+          return;
+        }
+        build_subtree(bp, left, method, spawn);
+        t = right;
+      }
+    }
+
+    /// @brief Fill in node t.slot and partition its primitives.
+    /// @return start of the right half, or t.end if the node became a leaf.
+    size_t split_node(std::vector<build_prim> &bp, const build_task &t, int method)
+    {
+      bvh_node &n = nodes[t.slot];
+      aabb box, centers;
+      for (size_t i = t.begin; i < t.end; i++)
+      {
+        box.extend(bp[i].box);
+        centers.extend(bp[i].center);
+      }
+      n.box = box;
+      n.axis = centers.longest_axis();
+      size_t count = t.end - t.begin;
+      size_t mid = t.end;
+      if (count <= BVH_LEAF_SIZE)
+      {
+        mid = t.end;
+      } else if (t.depth >= BVH_MAX_DEPTH || method == BVH_MEDIAN)
+      {
+        mid = median_split(bp, t, n.axis);
+      } else if (method == BVH_LBVH)
+      {
+        mid = morton_split(bp, t, n.axis);
+      } else
+      {
+        mid = sah_split(bp, t, box, centers, n.axis);
+      }
+      if (mid == t.end)
+      {
+        n.offset = t.begin;
+        n.count = count;
+      } else
+      {
+        n.offset = t.slot + 2 * (mid - t.begin);
+        n.count = 0;
+      }
+      return mid;
+    }
+
+    size_t median_split(std::vector<build_prim> &bp, const build_task &t, int axis)
+    {
+      size_t mid = (t.begin + t.end) / 2;
+      std::nth_element(bp.begin() + t.begin, bp.begin() + mid, bp.begin() + t.end,
+        [axis](const build_prim &a, const build_prim &b) { return a.center[axis] < b.center[axis]; });
+      return mid;
+    }
+
+    /// @brief Binned SAH (Wald 2007): bin centers along the longest axis and
+    /// pick the bin boundary with the least expected cost, or make a leaf
+    /// when that is cheaper.
+    size_t sah_split(std::vector<build_prim> &bp, const build_task &t, const aabb &box,
+      const aabb &centers, int axis)
+    {
+      size_t count = t.end - t.begin;
+      float lo = centers.min[axis], extent = centers.max[axis] - lo;
+      if (extent <= 0)
+      {
+        /// Every center coincides, bins cannot separate them.
+        return count <= BVH_MAX_LEAF ? t.end : median_split(bp, t, axis);
+      }
+      aabb bin_box[BVH_BINS];
+      size_t bin_count[BVH_BINS] = {0};
+      float scale = BVH_BINS / extent;
+      auto bin_of = [&](const build_prim &p) {
+        return std::min(BVH_BINS - 1, int((p.center[axis] - lo) * scale));
+      };
+      for (size_t i = t.begin; i < t.end; i++)
+      {
+        int b = bin_of(bp[i]);
+        bin_count[b]++;
+        bin_box[b].extend(bp[i].box);
+      }
+      /// Sweep from the right for the right hand areas, then from the left.
+      float right_area[BVH_BINS];
+      aabb acc;
+      size_t right_count[BVH_BINS];
+      size_t n = 0;
+      for (int b = BVH_BINS - 1; b > 0; b--)
+      {
+        acc.extend(bin_box[b]);
+        n += bin_count[b];
+        right_area[b] = acc.half_area();
+        right_count[b] = n;
+      }
+      acc = aabb();
+      n = 0;
+      int best = -1;
+      float best_cost = FLT_MAX;
+      for (int b = 0; b < BVH_BINS - 1; b++)
+      {
+        acc.extend(bin_box[b]);
+        n += bin_count[b];
+        if (n == 0 || right_count[b + 1] == 0)
+        {
+          continue;
+        }
+        float cost = n * acc.half_area() + right_count[b + 1] * right_area[b + 1];
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best = b;
+        }
+      }
+      /// Traversal step cost 1, intersection cost 1 per primitive.
+      float split_cost = 1 + best_cost / box.half_area();
+      if (best < 0 || (count <= BVH_MAX_LEAF && split_cost >= count))
+      {
+        return best < 0 && count > BVH_MAX_LEAF ? median_split(bp, t, axis) : t.end;
+      }
+      return std::partition(bp.begin() + t.begin, bp.begin() + t.end,
+        [&](const build_prim &p) { return bin_of(p) <= best; }) - bp.begin();
+    }
+
+    /// @brief Sort the primitives along the Z-order curve of their centers.
+    void assign_morton_codes(std::vector<build_prim> &bp, const aabb &centers)
+    {
+      for (size_t i = 0; i < bp.size(); i++)
+      {
+        bp[i].code = centers.morton_code(bp[i].center);
+      }
+      std::sort(bp.begin(), bp.end(),
+        [](const build_prim &a, const build_prim &b) { return a.code < b.code; });
+    }
+
+    /// @brief Split sorted Morton codes at their highest differing bit.
+    size_t morton_split(std::vector<build_prim> &bp, const build_task &t, int &axis)
+    {
+      uint32_t first = bp[t.begin].code, last = bp[t.end - 1].code;
+      if (first == last)
+      {
+        return (t.begin + t.end) / 2;
+      }
+      int bit = 31 - __builtin_clz(first ^ last);
+      axis = 2 - bit % 3;
+      /// Codes below the split have the bit clear, the rest have it set.
+      uint32_t mask = 1u << bit;
+      return std::partition_point(bp.begin() + t.begin, bp.begin() + t.end,
+        [mask](const build_prim &p) { return !(p.code & mask); }) - bp.begin();
+    }
+
+    /// @brief Squeeze unused slots out of the node array, keeping order.
+    void compact()
+    {
+      std::vector<int> remap(nodes.size());
+      size_t used = 0;
+      for (size_t k = 0; k < nodes.size(); k++)
+      {
+        remap[k] = used;
+        if (nodes[k].count >= 0)
+        {
+          nodes[used++] = nodes[k];
+        }
+      }
+      nodes.resize(used);
+      for (size_t k = 0; k < used; k++)
+      {
+        if (nodes[k].count == 0)
+        {
+          nodes[k].offset = remap[nodes[k].offset];
+        }
+      }
+    }
+
+    /// @brief Make a wide node over the given binary nodes, opening the
+    /// largest interior ones until all lanes are used, and recurse into the
+    /// interior nodes that remain.
+    /// @return index of the new wide node
+    int collapse(const int *from, int n)
+    {
+      int lanes[BVH_WIDTH];
+      std::copy(from, from + n, lanes);
+      while (n < BVH_WIDTH)
+      {
+        int open = -1;
+        float area = -1;
+        for (int c = 0; c < n; c++)
+        {
+          const bvh_node &b = nodes[lanes[c]];
+          if (b.count == 0 && b.box.half_area() > area)
+          {
+            open = c;
+            area = b.box.half_area();
+          }
+        }
+        if (open < 0)
+        {
+          break;
+        }
+        int k = lanes[open];
+        lanes[open] = k + 1;
+        lanes[n++] = nodes[k].offset;
+      }
+      int w = wide.size();
+      wide.push_back(wide_node());
+      for (int c = 0; c < BVH_WIDTH; c++)
+      {
+        wide[w].src[c] = -1;
+        wide[w].child[c] = 0;
+        for (int a = 0; a < 3; a++)
+        {
+          /// Inverted box, never hit.
+          wide[w].lo[a][c] = INFINITY;
+          wide[w].hi[a][c] = -INFINITY;
+        }
+      }
+      for (int c = 0; c < n; c++)
+      {
+        const bvh_node &b = nodes[lanes[c]];
+        wide[w].src[c] = lanes[c];
+        wide[w].set_box(c, b.box);
+        if (b.count > 0)
+        {
+          wide[w].child[c] = wide_leaf(b.offset, b.count);
+        } else
+        {
+          int kids[2] = {lanes[c] + 1, b.offset};
+          int child = collapse(kids, 2);
+          wide[w].child[c] = child;
+        }
+      }
+      return w;
+    }
+
+    /// @brief Requantize wide node w from the boxes of its binary nodes.
+    void quantize(size_t w)
+    {
+      quantized_node &q = qwide[w];
+      const int *src = &qsrc[w * BVH_WIDTH];
+      aabb all;
+      for (int c = 0; c < BVH_WIDTH && src[c] >= 0; c++)
+      {
+        all.extend(nodes[src[c]].box);
+      }
+      for (int a = 0; a < 3; a++)
+      {
+        float lo = all.min[a], hi = all.max[a];
+        float step = (hi - lo) / 255;
+        while (lo + 255 * step < hi)
+        {
+          step = nextafterf(step, INFINITY);
+        }
+        q.origin[a] = lo;
+        q.step[a] = step;
+        for (int c = 0; c < BVH_WIDTH; c++)
+        {
+          if (src[c] < 0)
+          {
+            q.lo[a][c] = 255;
+            q.hi[a][c] = 0;
+            continue;
+          }
+          const aabb &box = nodes[src[c]].box;
+          /// Round outwards, checking the decoded value as traversal
+          /// computes it.
+          int l = step > 0 ? std::max(0, std::min(255, int((box.min[a] - lo) / step))) : 0;
+          while (l > 0 && lo + l * step > box.min[a])
+          {
+            l--;
+          }
+          int h = step > 0 ? std::max(0, std::min(255, int(ceilf((box.max[a] - lo) / step)))) : 0;
+          while (h < 255 && lo + h * step < box.max[a])
+          {
+            h++;
+          }
+          q.lo[a][c] = l;
+          q.hi[a][c] = h;
+        }
+      }
+    }
+
+    /// @brief Convert four 8 bit steps to floats.
+    static inline __m128 unpack_steps(const uint8_t *q)
+    {
+      int packed;
+      memcpy(&packed, q, sizeof(packed));
+      __m128i zero = _mm_setzero_si128();
+      __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+      return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    }
+
+    /// @brief Slab test of a ray against the children of a quantized node,
+    /// see the float version below.
+    static inline int wide_hit(const quantized_node &n, const __m128 origin[3],
+      const __m128 inv_dir[3], const bool neg[3], float t_min, float t_max, float tnear[BVH_WIDTH])
+    {
+      __m128 t0 = _mm_set1_ps(t_min), t1 = _mm_set1_ps(t_max);
+      for (int a = 0; a < 3; a++)
+      {
+        __m128 base = _mm_set1_ps(n.origin[a]), step = _mm_set1_ps(n.step[a]);
+        __m128 lo = _mm_add_ps(base, _mm_mul_ps(unpack_steps(n.lo[a]), step));
+        __m128 hi = _mm_add_ps(base, _mm_mul_ps(unpack_steps(n.hi[a]), step));
+        __m128 tn = _mm_mul_ps(_mm_sub_ps(neg[a] ? hi : lo, origin[a]), inv_dir[a]);
+        __m128 tf = _mm_mul_ps(_mm_sub_ps(neg[a] ? lo : hi, origin[a]), inv_dir[a]);
+        t0 = _mm_max_ps(tn, t0);
+        t1 = _mm_min_ps(tf, t1);
+      }
+      _mm_storeu_ps(tnear, t0);
+      __m128i empty = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)n.child), _mm_setzero_si128());
+      return _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ~_mm_movemask_ps(_mm_castsi128_ps(empty));
+    }
+
+    /// @brief Slab test of a ray against the four children of a wide node.
+    /// @param tnear entry distances of the children, out
+    /// @return bit mask of the children hit
+    static inline int wide_hit(const wide_node &n, const __m128 origin[3], const __m128 inv_dir[3],
+      const bool neg[3], float t_min, float t_max, float tnear[BVH_WIDTH])
+    {
+      __m128 t0 = _mm_set1_ps(t_min), t1 = _mm_set1_ps(t_max);
+      for (int a = 0; a < 3; a++)
+      {
+        const float *near = neg[a] ? n.hi[a] : n.lo[a];
+        const float *far = neg[a] ? n.lo[a] : n.hi[a];
+        __m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near), origin[a]), inv_dir[a]);
+        __m128 tf = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far), origin[a]), inv_dir[a]);
+        /// The running bound is the second operand, so it survives a NaN
+        /// from a zero direction component on the slab plane.
+        t0 = _mm_max_ps(tn, t0);
+        t1 = _mm_min_ps(tf, t1);
+      }
+      _mm_storeu_ps(tnear, t0);
+      return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+
+    /// @brief Expected traversal cost relative to the root (traversal and
+    /// intersection cost 1), also collecting the other statistics.
+    float sah_cost()
+    {
+      build_stats.nodes = nodes.size();
+      build_stats.leaves = 0;
+      build_stats.depth = 0;
+      build_stats.wide_nodes = wide.size() + qwide.size();
+      if (nodes.empty())
+      {
+        return 0;
+      }
+      float root = std::max(nodes[0].box.half_area(), 1e-20f);
+      double cost = 0;
+      std::vector<std::pair<int, int>> stack(1, std::make_pair(0, 1));
+      while (!stack.empty())
+      {
+        std::pair<int, int> top = stack.back();
+        stack.pop_back();
+        const bvh_node &n = nodes[top.first];
+        float area = n.box.half_area() / root;
+        build_stats.depth = std::max(build_stats.depth, top.second);
+        if (n.count > 0)
+        {
+          build_stats.leaves++;
+          cost += area * n.count;
+        } else
+        {
+          cost += area;
+          stack.push_back(std::make_pair(top.first + 1, top.second + 1));
+          stack.push_back(std::make_pair(n.offset, top.second + 1));
+        }
+      }
+      return cost;
+    }
+
+    std::vector<hitable *> prims;  /* Owned objects, in leaf order. */
+    std::vector<bvh_node> nodes;   /* Depth first, root first. */
+    std::vector<wide_node> wide;   /* Collapsed tree, root first. */
+    std::vector<quantized_node> qwide;  /* Same tree quantized, replaces wide. */
+    std::vector<int> qsrc;         /* Binary node of each quantized lane. */
+
+    template <class N>
+    bool closest_hit(const std::vector<N> &tree, const ray &r, float t_min, float t_max,
+      hit_record &rec) const;
+    template <class N>
+    bool any_hit(const std::vector<N> &tree, const ray &r, float t_min, float t_max) const;
+    /// @brief Most entries a traversal pushing up to width - 1 children per
+    /// level can hold, from the depth measured at build time. Collapsing
+    /// never deepens the tree, so this also bounds the wide traversals.
+    inline size_t stack_need(int width) const
+    {
+      return size_t(std::max(build_stats.depth, 1)) * (width - 1) + 1;
+    }
+    bvh_stats build_stats;
+};
+
+bool bvh::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+{
+  return qwide.empty() ? closest_hit(wide, r, t_min, t_max, rec) : closest_hit(qwide, r, t_min, t_max, rec);
+}
+
+bool bvh::occluded(const ray &r, float t_min, float t_max) const
+{
+  return qwide.empty() ? any_hit(wide, r, t_min, t_max) : any_hit(qwide, r, t_min, t_max);
+}
+
+/// @brief Closest hit on a wide tree. Children hit are visited nearest
+/// first; pending ones are skipped once a closer hit is known.
+template <class N>
+bool bvh::closest_hit(const std::vector<N> &tree, const ray &r, float t_min, float t_max,
+  hit_record &rec) const
+{
+  if (tree.empty())
+  {
+    return false;
+  }
+  vec3 inv = vec3(1, 1, 1) / r.direction();
+  __m128 origin[3], inv_dir[3];
+  bool neg[3];
+  for (int a = 0; a < 3; a++)
+  {
+    origin[a] = _mm_set1_ps(r.origin()[a]);
+    inv_dir[a] = _mm_set1_ps(inv[a]);
+    neg[a] = inv[a] < 0;
+  }
+  traversal_stack<wide_entry, BVH_WIDE_STACK> frames(stack_need(BVH_WIDTH));
+  wide_entry *stack = frames.data;
+  int top = 0;
+  int child = 0;
+  bool did_hit = false;
+  for (;;)
+  {
+    if (child >= 0)
+    {
+      const N &n = tree[child];
+      float tnear[BVH_WIDTH];
+      int mask = wide_hit(n, origin, inv_dir, neg, t_min, t_max, tnear);
+      if (mask != 0)
+      {
+        /// Sort the children hit by distance, farthest first.
+        wide_entry found[BVH_WIDTH];
+        int count = 0;
+        for (int c = 0; c < BVH_WIDTH; c++)
+        {
+          if (mask & (1 << c))
+          {
+            wide_entry e = {n.child[c], tnear[c]};
+            int k = count++;
+            for (; k > 0 && found[k - 1].t < e.t; k--)
+            {
+              found[k] = found[k - 1];
+            }
+            found[k] = e;
+          }
+        }
+        for (int k = 0; k < count - 1; k++)
+        {
+          stack[top++] = found[k];
+        }
+        child = found[count - 1].child;
+        continue;
+      }
+    } else
+    {
+      int offset = leaf_offset(child);
+      for (int i = offset; i < offset + leaf_count(child); i++)
+      {
+        if (prims[i]->hit(r, t_min, t_max, rec))
+        {
+          did_hit = true;
+          t_max = rec.t;
+        }
+      }
+    }
+    while (top > 0 && stack[top - 1].t > t_max)
+    {
+      top--;
+    }
+    if (top == 0)
+    {
+      break;
+    }
+    child = stack[--top].child;
+  }
+  return did_hit;
+}
+
+/// @brief Closest hit, visiting the nearer child first so far subtrees are
+/// culled by the shrinking t_max.
+bool bvh::hit_binary(const ray &r, float t_min, float t_max, hit_record &rec) const
+{
+  if (nodes.empty())
+  {
+    return false;
+  }
+  vec3 origin = r.origin();
+  vec3 inv_dir = vec3(1, 1, 1) / r.direction();
+  bool neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+  traversal_stack<int, BVH_STACK> frames(stack_need(2));
+  int *stack = frames.data;
+  int top = 0;
+  int node = 0;
+  bool did_hit = false;
+  for (;;)
+  {
+    const bvh_node &n = nodes[node];
+    if (n.box.hit(origin, inv_dir, t_min, t_max))
+    {
+      if (n.count > 0)
+      {
+        for (int i = n.offset; i < n.offset + n.count; i++)
+        {
+          if (prims[i]->hit(r, t_min, t_max, rec))
+          {
+            did_hit = true;
+            t_max = rec.t;
+          }
+        }
+      } else if (neg[n.axis])
+      {
+        stack[top++] = node + 1;
+        node = n.offset;
+        continue;
+      } else
+      {
+        stack[top++] = n.offset;
+        node = node + 1;
+        continue;
+      }
+    }
+    if (top == 0)
+    {
+      break;
+    }
+    node = stack[--top];
+  }
+  return did_hit;
+}
+
+/// @brief Any hit on a wide tree, returns at the first object blocking
+/// the segment.
+template <class N>
+bool bvh::any_hit(const std::vector<N> &tree, const ray &r, float t_min, float t_max) const
+{
+  if (tree.empty())
+  {
+    return false;
+  }
+  vec3 inv = vec3(1, 1, 1) / r.direction();
+  __m128 origin[3], inv_dir[3];
+  bool neg[3];
+  for (int a = 0; a < 3; a++)
+  {
+    origin[a] = _mm_set1_ps(r.origin()[a]);
+    inv_dir[a] = _mm_set1_ps(inv[a]);
+    neg[a] = inv[a] < 0;
+  }
+  traversal_stack<int, BVH_WIDE_STACK> frames(stack_need(BVH_WIDTH));
+  int *stack = frames.data;
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    int child = stack[--top];
+    if (child >= 0)
+    {
+      const N &n = tree[child];
+      float tnear[BVH_WIDTH];
+      int mask = wide_hit(n, origin, inv_dir, neg, t_min, t_max, tnear);
+      for (int c = 0; c < BVH_WIDTH; c++)
+      {
+        if (mask & (1 << c))
+        {
+          stack[top++] = n.child[c];
+        }
+      }
+    } else
+    {
+      int offset = leaf_offset(child);
+      for (int i = offset; i < offset + leaf_count(child); i++)
+      {
+        if (prims[i]->occluded(r, t_min, t_max))
+        {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+#endif
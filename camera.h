@@ -73,11 +73,18 @@ class camera
     }
     
     
-    ray get_ray(float u, float v)
+    ray get_ray(float u, float v) const
     {
       return ray(origin, corner + (u * horizontal) + (v * vertical) - origin);
     }
 
+    /// @brief Cone spread of a camera ray covering one of rows pixel rows.
+    float pixel_spread(int rows) const
+    {
+      /// The frame sits at t = 1, so a pixel's height is the spread per unit t.
+      return vertical.length() / rows;
+    }
+
   private:
     vec3 origin; // Camera origin
     vec3 corner; // Top left corner of frame
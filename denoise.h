@@ -0,0 +1,396 @@
+#ifndef DENOISEH
+#define DENOISEH
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <emmintrin.h>
+#include "vec3.h"
+#include "ray.h"
+#include "hitable.h"
+#include "materials.h"
+#include "util.h"
+#include "threads.h"
+#include "arena.h"
+#include "scene.h"
+#include "render.h"
+#include "output.h"
+
+#define FEATURE_SAMPLES 16      /// Camera samples per pixel averaged into the features
+#define FEATURE_SPECULAR 4      /// Mirror and glass bounces followed to a diffuse surface
+#define FEATURE_MISS_DEPTH 1e6f /// Depth of rays that leave the scene
+#define DENOISE_PASSES 5        /// A-trous levels, the last one spans 2^(PASSES+1) pixels
+#define DENOISE_SIGMA_COLOR 0.5f  /// Edge stop on gamma 2 irradiance, halved every pass
+#define DENOISE_SIGMA_NORMAL 0.3f
+#define DENOISE_SIGMA_DEPTH 0.1f  /// Relative to the depth of the center pixel
+#define DENOISE_SIGMA_ALBEDO 0.1f
+
+/// First-hit feature buffers of a frame, planar and row-major, rows counted
+/// from the bottom like the renderer: value k is pixel (k % nX, k / nX).
+typedef struct feature_buffers
+{
+  int nX, nY;
+  std::vector<float> albedo[3];  /// Surface color, through mirrors and glass
+  std::vector<float> normal[3];  /// World space normal of that surface
+  std::vector<float> depth;      /// Distance to the first hit
+} feature_buffers;
+
+/// @brief Average the features of the first FEATURE_SAMPLES camera samples
+/// of pixel (i, j). Perfectly specular surfaces pass their attenuation on to
+/// the diffuse surface seen through them, which is what the denoiser must
+/// keep sharp.
+void pixel_features(const scene *scn, const frame_ctx &frame, int i, int j,
+  vec3 &albedo, vec3 &normal, float &depth)
+{
+  int n = std::min<int>(frame.nS, FEATURE_SAMPLES);
+  albedo = normal = BLACK;
+  depth = 0;
+  for (int s = 0; s < n; s++)
+  {
+    ray r = camera_ray(frame, i, j, s);
+    vec3 through = WHITE;
+    float first = FEATURE_MISS_DEPTH;
+    for (int bounce = 0; ; bounce++)
+    {
+      hit_record rec;
+      if (!scn->world->hit(r, 0.0001, MAXFLOAT, rec))
+      {
+        /// The background is its own albedo, facing the ray.
+        albedo += through;
+        normal -= unit_vector(r.direction());
+        break;
+      }
+      if (bounce == 0)
+      {
+        first = rec.t * r.direction().length();
+      }
+      ray scattered;
+      vec3 attenuation;
+      if (rec.mat->is_diffuse() || bounce == FEATURE_SPECULAR
+          || !rec.mat->scatter(r, rec, attenuation, scattered))
+      {
+        albedo += through * rec.mat->reflectance(rec);
+        normal += rec.normal;
+        break;
+      }
+      through *= attenuation;
+      scattered.time = r.time;
+      r = scattered;
+    }
+    depth += first;
+  }
+  albedo /= n;
+  normal /= n;
+  depth /= n;
+}
+
+/// @brief Compute the feature buffers of a frame on the shared pool.
+feature_buffers render_features(const scene *scn, const frame_ctx &frame)
+{
+  feature_buffers f;
+  f.nX = frame.nX;
+  f.nY = frame.nY;
+  size_t n = size_t(f.nX) * f.nY;
+  for (int c = 0; c < 3; c++)
+  {
+    f.albedo[c].resize(n);
+    f.normal[c].resize(n);
+  }
+  f.depth.resize(n);
+  task_group group;
+  group.add(f.nY);
+  for (int j = 0; j < f.nY; j++)
+  {
+    shared_pool().submit([&, j] {
+      for (int i = 0; i < f.nX; i++)
+      {
+        size_t k = size_t(j) * f.nX + i;
+        vec3 albedo, normal;
+        pixel_features(scn, frame, i, j, albedo, normal, f.depth[k]);
+        for (int c = 0; c < 3; c++)
+        {
+          f.albedo[c][k] = albedo[c];
+          f.normal[c][k] = normal[c];
+        }
+      }
+      group.done();
+    });
+  }
+  group.wait();
+  return f;
+}
+
+/// @brief Output path of feature name next to the color output:
+/// "out.png" becomes "out_albedo.png".
+std::string feature_filename(const std::string &out, const char *name)
+{
+  size_t dot = out.rfind('.');
+  size_t slash = out.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+  {
+    return out + "_" + name;
+  }
+  return out.substr(0, dot) + "_" + name + out.substr(dot);
+}
+
+/// @brief Write the albedo, normal and depth buffers next to the output.
+/// Normals are mapped from [-1, 1] to [0, 1], depth is divided by the
+/// largest finite depth. Linear values, like the color output.
+/// @return number of files that could not be written.
+int write_features(const std::string &out, const feature_buffers &f)
+{
+  image_buffer albedo(f.nX, f.nY), normal(f.nX, f.nY), depth(f.nX, f.nY);
+  float far = 0;
+  for (size_t k = 0; k < f.depth.size(); k++)
+  {
+    far = f.depth[k] < FEATURE_MISS_DEPTH ? std::max(far, f.depth[k]) : far;
+  }
+  for (int j = 0; j < f.nY; j++)
+  {
+    for (int i = 0; i < f.nX; i++)
+    {
+      size_t k = size_t(j) * f.nX + i;
+      albedo.set(i, j, vec3(f.albedo[0][k], f.albedo[1][k], f.albedo[2][k]));
+      normal.set(i, j, 0.5f * vec3(f.normal[0][k] + 1, f.normal[1][k] + 1, f.normal[2][k] + 1));
+      float d = far > 0 ? std::min(1.0f, f.depth[k] / far) : 0;
+      depth.set(i, j, vec3(d, d, d));
+    }
+  }
+  return (write_image(feature_filename(out, "albedo"), albedo) != 0)
+    + (write_image(feature_filename(out, "normal"), normal) != 0)
+    + (write_image(feature_filename(out, "depth"), depth) != 0);
+}
+
+/// Coefficients of 2^f on [0, 1).
+#define EXP2_C1 0.693147f
+#define EXP2_C2 0.240227f
+#define EXP2_C3 0.0555041f
+#define EXP2_C4 0.00961813f
+#define EXP2_C5 0.00133336f
+
+/// @brief exp(x) for x <= 0, relative error below 1e-6. Same arithmetic
+/// as exp_neg4, for the pixels left over at the end of a row.
+inline float exp_neg(float x)
+{
+  float t = x * 1.44269504f;
+  /// Like _mm_max_ps in exp_neg4, NaN becomes -126: int(NaN) is undefined.
+  t = !(t > -126.0f) ? -126.0f : t;
+  int whole = int(t);
+  whole -= t < whole;
+  float f = t - whole;
+  float p = 1 + f * (EXP2_C1 + f * (EXP2_C2 + f * (EXP2_C3 + f * (EXP2_C4 + f * EXP2_C5))));
+  int bits = (whole + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+/// @brief exp_neg of four values.
+inline __m128 exp_neg4(__m128 x)
+{
+  __m128 t = _mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)), _mm_set1_ps(-126.0f));
+  __m128i whole = _mm_cvttps_epi32(t);
+  /// Truncation rounds negative values up; the mask is -1 where it did.
+  whole = _mm_add_epi32(whole, _mm_castps_si128(_mm_cmplt_ps(t, _mm_cvtepi32_ps(whole))));
+  __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(whole));
+  __m128 p = _mm_add_ps(_mm_set1_ps(EXP2_C4), _mm_mul_ps(f, _mm_set1_ps(EXP2_C5)));
+  p = _mm_add_ps(_mm_set1_ps(EXP2_C3), _mm_mul_ps(f, p));
+  p = _mm_add_ps(_mm_set1_ps(EXP2_C2), _mm_mul_ps(f, p));
+  p = _mm_add_ps(_mm_set1_ps(EXP2_C1), _mm_mul_ps(f, p));
+  p = _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(f, p));
+  __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(whole, _mm_set1_epi32(127)), 23));
+  return _mm_mul_ps(p, scale);
+}
+
+/// Planar feature and color channels of one filter pass.
+typedef struct atrous_planes
+{
+  const float *color[3], *normal[3], *albedo[3], *depth;
+} atrous_planes;
+
+/// Inverse squared edge-stopping widths of one filter pass.
+typedef struct atrous_sigmas
+{
+  float color, normal, albedo;
+} atrous_sigmas;
+
+/// @brief Exponent of the edge-stopping weight of pixel q against center p.
+inline float atrous_exponent(const atrous_planes &in, const atrous_sigmas &inv, float inv_depth,
+  size_t p, size_t q)
+{
+  float dc = 0, dn = 0, da = 0;
+  for (int c = 0; c < 3; c++)
+  {
+    float e = in.color[c][q] - in.color[c][p];
+    dc += e * e;
+    e = in.normal[c][q] - in.normal[c][p];
+    dn += e * e;
+    e = in.albedo[c][q] - in.albedo[c][p];
+    da += e * e;
+  }
+  return dc * inv.color + dn * inv.normal + da * inv.albedo + fabsf(in.depth[q] - in.depth[p]) * inv_depth;
+}
+
+/// @brief atrous_exponent of the four centers p..p+3 against q..q+3.
+inline __m128 atrous_exponent4(const atrous_planes &in, const atrous_sigmas &inv, __m128 inv_depth,
+  size_t p, size_t q)
+{
+  __m128 dc = _mm_setzero_ps(), dn = _mm_setzero_ps(), da = _mm_setzero_ps();
+  for (int c = 0; c < 3; c++)
+  {
+    __m128 e = _mm_sub_ps(_mm_loadu_ps(in.color[c] + q), _mm_loadu_ps(in.color[c] + p));
+    dc = _mm_add_ps(dc, _mm_mul_ps(e, e));
+    e = _mm_sub_ps(_mm_loadu_ps(in.normal[c] + q), _mm_loadu_ps(in.normal[c] + p));
+    dn = _mm_add_ps(dn, _mm_mul_ps(e, e));
+    e = _mm_sub_ps(_mm_loadu_ps(in.albedo[c] + q), _mm_loadu_ps(in.albedo[c] + p));
+    da = _mm_add_ps(da, _mm_mul_ps(e, e));
+  }
+  __m128 dz = _mm_sub_ps(_mm_loadu_ps(in.depth + q), _mm_loadu_ps(in.depth + p));
+  dz = _mm_andnot_ps(_mm_set1_ps(-0.0f), dz);
+  __m128 x = _mm_add_ps(_mm_mul_ps(dc, _mm_set1_ps(inv.color)), _mm_mul_ps(dn, _mm_set1_ps(inv.normal)));
+  x = _mm_add_ps(x, _mm_mul_ps(da, _mm_set1_ps(inv.albedo)));
+  return _mm_add_ps(x, _mm_mul_ps(dz, inv_depth));
+}
+
+/// @brief One edge-avoiding a-trous pass (Dammertz et al. 2010): a 5x5
+/// B3-spline kernel with taps step pixels apart, each tap weighted down by
+/// its difference to the center in color, normal, depth and albedo.
+///
+/// Rows run in parallel; within a row the taps are the outer loop and the
+/// pixels the inner one, four at a time with SSE over the planar arrays.
+/// @param in planar gamma 2 irradiance
+/// @param out (OUT) filtered planar irradiance
+void atrous_pass(const feature_buffers &f, const std::vector<float> in[3], std::vector<float> out[3],
+  int step, float sigma_color)
+{
+  static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+  atrous_planes planes;
+  for (int c = 0; c < 3; c++)
+  {
+    planes.color[c] = in[c].data();
+    planes.normal[c] = f.normal[c].data();
+    planes.albedo[c] = f.albedo[c].data();
+  }
+  planes.depth = f.depth.data();
+  atrous_sigmas inv;
+  inv.color = 1 / (sigma_color * sigma_color);
+  inv.normal = 1 / (DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL);
+  inv.albedo = 1 / (DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO);
+  int nX = f.nX;
+  task_group group;
+  group.add(f.nY);
+  for (int j = 0; j < f.nY; j++)
+  {
+    shared_pool().submit([&, j] {
+      arena_scope scope;
+      float *acc = thread_arena().alloc<float>(5 * nX, 0.0f);
+      float *sum[3] = {&acc[0], &acc[nX], &acc[2 * nX]};
+      float *total = &acc[3 * nX];
+      float *inv_depth = &acc[4 * nX];
+      size_t p0 = size_t(j) * nX;
+      for (int i = 0; i < nX; i++)
+      {
+        inv_depth[i] = 1 / (DENOISE_SIGMA_DEPTH * std::max(planes.depth[p0 + i], 1e-4f));
+      }
+      for (int dy = -2; dy <= 2; dy++)
+      {
+        int y = j + dy * step;
+        if (y < 0 || y >= f.nY)
+        {
+          continue;
+        }
+        for (int dx = -2; dx <= 2; dx++)
+        {
+          int offset = dx * step;
+          int first = std::max(0, -offset), last = std::min(nX, nX - offset);
+          size_t q0 = size_t(y) * nX + offset;
+          float k = kernel[dx + 2] * kernel[dy + 2];
+          int i = first;
+          for (; i + 4 <= last; i += 4)
+          {
+            __m128 x = atrous_exponent4(planes, inv, _mm_loadu_ps(inv_depth + i), p0 + i, q0 + i);
+            __m128 w = _mm_mul_ps(_mm_set1_ps(k), exp_neg4(_mm_sub_ps(_mm_setzero_ps(), x)));
+            for (int c = 0; c < 3; c++)
+            {
+              __m128 v = _mm_mul_ps(w, _mm_loadu_ps(planes.color[c] + q0 + i));
+              _mm_storeu_ps(sum[c] + i, _mm_add_ps(_mm_loadu_ps(sum[c] + i), v));
+            }
+            _mm_storeu_ps(total + i, _mm_add_ps(_mm_loadu_ps(total + i), w));
+          }
+          for (; i < last; i++)
+          {
+            float w = k * exp_neg(-atrous_exponent(planes, inv, inv_depth[i], p0 + i, q0 + i));
+            for (int c = 0; c < 3; c++)
+            {
+              sum[c][i] += w * planes.color[c][q0 + i];
+            }
+            total[i] += w;
+          }
+        }
+      }
+      /// The center tap always has weight kernel[2]^2, total is never 0.
+      for (int c = 0; c < 3; c++)
+      {
+        for (int i = 0; i < nX; i++)
+        {
+          out[c][p0 + i] = sum[c][i] / total[i];
+        }
+      }
+      group.done();
+    });
+  }
+  group.wait();
+}
+
+/// @brief Denoise a rendered image in place, guided by its features.
+///
+/// The color is divided by the albedo so that texture detail is not blurred,
+/// filtered in gamma 2 space where the edge stop treats dark and bright
+/// regions alike, and multiplied back.
+/// @param image pixel matrix from generate_image
+void denoise_image(vec3 **image, const feature_buffers &f)
+{
+  size_t n = size_t(f.nX) * f.nY;
+  std::vector<float> buf[2][3];
+  for (int c = 0; c < 3; c++)
+  {
+    buf[0][c].resize(n);
+    buf[1][c].resize(n);
+  }
+  for (int j = 0; j < f.nY; j++)
+  {
+    for (int i = 0; i < f.nX; i++)
+    {
+      size_t k = size_t(j) * f.nX + i;
+      for (int c = 0; c < 3; c++)
+      {
+        buf[0][c][k] = sqrtf(image[i][j][c] / std::max(f.albedo[c][k], 0.01f));
+      }
+    }
+  }
+  int cur = 0;
+  float sigma = DENOISE_SIGMA_COLOR;
+  for (int pass = 0; pass < DENOISE_PASSES; pass++)
+  {
+    atrous_pass(f, buf[cur], buf[1 - cur], 1 << pass, sigma);
+    cur = 1 - cur;
+    sigma *= 0.5f;
+  }
+  for (int j = 0; j < f.nY; j++)
+  {
+    for (int i = 0; i < f.nX; i++)
+    {
+      size_t k = size_t(j) * f.nX + i;
+      float c[3];
+      for (int a = 0; a < 3; a++)
+      {
+        c[a] = buf[cur][a][k] * buf[cur][a][k] * std::max(f.albedo[a][k], 0.01f);
+      }
+      image[i][j] = vec3(c[0], c[1], c[2]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef DISTRIBH
+#define DISTRIBH
+
+#include <unistd.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <iostream>
+#include "vec3.h"
+#include "util.h"
+#include "render.h"
+#include "server.h"
+#include "net.h"
+
+#define TILE_SIZE_DEFAULT 32
+#define TILE_ATTEMPTS 3      /// Times a tile is handed out before giving up
+#define WORKER_RECONNECTS 3  /// Reconnect attempts after a worker fails
+
+/// Tile coordinator class
+/// Splits a frame into tiles and farms them out to render daemons (see
+/// render_server) reachable over Unix sockets or TCP. Each worker address
+/// gets one connection thread pulling tiles from a shared queue; a tile
+/// whose worker fails is queued again for any other worker. Pixels are
+/// seeded per sample, so the assembled image is bit-identical to a local
+/// render of the same job.
+class tile_coordinator
+{
+  public:
+    /// @param j job to render, every worker loads j.scene itself
+    /// @param addrs worker addresses
+    /// @param tile_size edge length of the square tiles
+    tile_coordinator(const render_job &j, const std::vector<std::string> &addrs, int tile_size):
+      job(j), workers(addrs), in_flight(0), failed(false)
+    {
+      int nX = job.frame.nX, nY = job.frame.nY;
+      for (int y = 0; y < nY; y += tile_size)
+      {
+        for (int x = 0; x < nX; x += tile_size)
+        {
+          tile_rect t = {x, y, std::min(x + tile_size, nX), std::min(y + tile_size, nY)};
+          pending.push_back(pending_tile{t, 0});
+        }
+      }
+    }
+
+    /// @brief Render the frame into image.
+    /// @param image (OUT) pixel matrix from allocate_image
+    /// @return true iff every tile was rendered.
+    bool render(vec3 **image)
+    {
+      std::vector<std::thread> threads;
+      for (size_t w = 0; w < workers.size(); w++)
+      {
+        threads.push_back(std::thread(&tile_coordinator::drive, this, w, image));
+      }
+      for (size_t w = 0; w < threads.size(); w++)
+      {
+        threads[w].join();
+      }
+      return !failed && pending.empty();
+    }
+
+  private:
+    typedef struct pending_tile
+    {
+      tile_rect rect;
+      int attempts; /* Times the tile was handed to a worker. */
+    } pending_tile;
+
+    /// @brief Take the next tile, waiting while others may still be requeued.
+    /// @return false once no work is left.
+    bool next(pending_tile &t)
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this] { return failed || !pending.empty() || in_flight == 0; });
+      if (failed || pending.empty())
+      {
+        return false;
+      }
+      t = pending.front();
+      pending.pop_front();
+      t.attempts++;
+      in_flight++;
+      return true;
+    }
+
+    /// @brief Return a tile to the queue, or abort the render if it failed too often.
+    void retry(const pending_tile &t)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      in_flight--;
+      if (t.attempts >= TILE_ATTEMPTS)
+      {
+        std::cerr << "Tile " << t.rect.x0 << "," << t.rect.y0 << " failed "
+                  << t.attempts << " times, giving up\n";
+        failed = true;
+      } else
+      {
+        pending.push_back(t);
+      }
+      cv.notify_all();
+    }
+
+    /// Mark a tile rendered.
+    void finish()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      in_flight--;
+      cv.notify_all();
+    }
+
+    /// @brief Send one tile to a worker and copy the reply into image.
+    /// @return false if the connection failed or the worker refused.
+    bool render_remote(int fd, const tile_rect &t, vec3 **image)
+    {
+      std::ostringstream os;
+      os << "tile " << t.x0 << " " << t.y0 << " " << t.x1 << " " << t.y1 << " "
+         << format_job(job).substr(strlen("render "));
+      std::string reply;
+      if (!send_line(fd, os.str()) || !recv_line(fd, reply))
+      {
+        return false;
+      }
+      std::istringstream is(reply);
+      std::string cmd;
+      tile_rect r;
+      if (!(is >> cmd >> r.x0 >> r.y0 >> r.x1 >> r.y1) || cmd != "tile"
+          || r.x0 != t.x0 || r.y0 != t.y0 || r.x1 != t.x1 || r.y1 != t.y1)
+      {
+        std::cerr << "Worker replied: " << reply << "\n";
+        return false;
+      }
+      std::vector<vec3> pixels(t.width() * t.height());
+      if (!recv_all(fd, pixels.data(), pixels.size() * sizeof(vec3)))
+      {
+        return false;
+      }
+      /// Tiles never overlap, so workers can fill the image without locking.
+      for (int j = t.y0; j < t.y1; j++)
+      {
+        for (int i = t.x0; i < t.x1; i++)
+        {
+          image[i][j] = pixels[(j - t.y0) * t.width() + (i - t.x0)];
+        }
+      }
+      return true;
+    }
+
+    /// Connection thread for worker w.
+    void drive(size_t w, vec3 **image)
+    {
+      const char *addr = workers[w].c_str();
+      int fd = -1;
+      int reconnects = 0;
+      pending_tile t;
+      while (next(t))
+      {
+        while (fd < 0 && reconnects <= WORKER_RECONNECTS)
+        {
+          fd = connect_addr(addr);
+          if (fd < 0)
+          {
+            reconnects++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100 * reconnects));
+          }
+        }
+        if (fd < 0)
+        {
+          /// Worker is gone for good, let the others take its tiles.
+          std::cerr << "Worker " << addr << " unreachable\n";
+          retry_unattempted(t);
+          return;
+        }
+        if (render_remote(fd, t.rect, image))
+        {
+          finish();
+        } else
+        {
+          close(fd);
+          fd = -1;
+          reconnects++;
+          retry(t);
+        }
+      }
+      if (fd >= 0)
+      {
+        send_line(fd, "quit");
+        close(fd);
+      }
+    }
+
+    /// Requeue a tile that never reached a worker, without counting the attempt.
+    void retry_unattempted(pending_tile t)
+    {
+      t.attempts--;
+      retry(t);
+    }
+
+    render_job job;
+    std::vector<std::string> workers;  /* Worker addresses. */
+    std::deque<pending_tile> pending;  /* Tiles waiting for a worker. */
+    int in_flight;                     /* Tiles currently handed out. */
+    bool failed;                       /* A tile ran out of attempts. */
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+/// @brief Split a comma separated address list.
+std::vector<std::string> split_addrs(const char *list)
+{
+  std::vector<std::string> addrs;
+  std::istringstream is(list);
+  std::string addr;
+  while (std::getline(is, addr, ','))
+  {
+    if (!addr.empty())
+    {
+      addrs.push_back(addr);
+    }
+  }
+  return addrs;
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef ENVIRONMENTH
+#define ENVIRONMENTH
+
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "vec3.h"
+#include "stb_image.h"
+
+/// Environment light class
+/// Radiance arriving from infinitely far away, stored as an equirectangular
+/// (latitude-longitude) HDR image with +y up. Directions are importance
+/// sampled in proportion to texel luminance through a marginal CDF over rows
+/// and one conditional CDF over the columns of every row.
+class environment
+{
+  public:
+    environment(): width(0), height(0) {}
+
+    /// @brief Load an .hdr (or any format stb_image reads) as linear RGB.
+    /// @param path image file
+    /// @param err (OUT) reason for failure
+    /// @return true iff the image was loaded.
+    bool load(const char *path, std::string &err)
+    {
+      int n;
+      float *data = stbi_loadf(path, &width, &height, &n, 3);
+      if (!data)
+      {
+        err = std::string("cannot load ") + path + ": " + stbi_failure_reason();
+        return false;
+      }
+      rgb.assign(data, data + 3 * width * height);
+      stbi_image_free(data);
+      build_distribution();
+      return true;
+    }
+
+    /// @brief Radiance arriving from unit direction d.
+    vec3 radiance(const vec3 &d) const
+    {
+      const float *p = &rgb[3 * texel(d)];
+      return vec3(p[0], p[1], p[2]);
+    }
+
+    /// @brief Importance sample a direction.
+    /// @param u1 selects the row
+    /// @param u2 selects the column within the row
+    /// @param wi (OUT) unit direction towards the environment
+    /// @param pdf (OUT) solid angle density of wi
+    /// @return false if the environment is black.
+    bool sample(float u1, float u2, vec3 &wi, float &pdf) const
+    {
+      if (total <= 0)
+      {
+        return false;
+      }
+      int y = find_interval(&marginal[0], height, u1);
+      const float *row = &conditional[y * (width + 1)];
+      int x = find_interval(row, width, u2);
+      /// Place the sample continuously inside the chosen texel.
+      float dv = (u1 - marginal[y]) / std::max(marginal[y + 1] - marginal[y], 1e-20f);
+      float du = (u2 - row[x]) / std::max(row[x + 1] - row[x], 1e-20f);
+      float u = (x + std::min(du, 0.99999f)) / width;
+      float v = (y + std::min(dv, 0.99999f)) / height;
+      float theta = float(M_PI) * v;
+      float phi = 2 * float(M_PI) * (u - 0.5f);
+      float sin_theta = sinf(theta);
+      wi = vec3(sin_theta * sinf(phi), cosf(theta), -sin_theta * cosf(phi));
+      pdf = texel_pdf(y * width + x, sin_theta);
+      return pdf > 0;
+    }
+
+    /// @brief Solid angle density with which sample() returns direction d.
+    float pdf(const vec3 &d) const
+    {
+      if (total <= 0)
+      {
+        return 0;
+      }
+      float sin_theta = sqrtf(std::max(0.0f, 1 - d.y() * d.y()));
+      return texel_pdf(texel(d), sin_theta);
+    }
+
+  private:
+    /// @brief Index of the texel seen in unit direction d.
+    int texel(const vec3 &d) const
+    {
+      float u = 0.5f + atan2f(d.x(), -d.z()) / (2 * float(M_PI));
+      float v = acosf(std::max(-1.0f, std::min(1.0f, d.y()))) / float(M_PI);
+      int x = std::min(width - 1, std::max(0, int(u * width)));
+      int y = std::min(height - 1, std::max(0, int(v * height)));
+      return y * width + x;
+    }
+
+    /// Texels are chosen with probability weight / total over the unit
+    /// square; mapping to the sphere divides by the Jacobian 2 pi^2 sin(theta).
+    float texel_pdf(int t, float sin_theta) const
+    {
+      if (sin_theta <= 0)
+      {
+        return 0;
+      }
+      float p = weight[t] * width * height / total;
+      return p / (2 * float(M_PI) * float(M_PI) * sin_theta);
+    }
+
+    /// @brief Index i of the interval cdf[i] <= u < cdf[i + 1] of an n entry CDF.
+    static int find_interval(const float *cdf, int n, float u)
+    {
+      int i = int(std::upper_bound(cdf, cdf + n + 1, u) - cdf) - 1;
+      return std::max(0, std::min(n - 1, i));
+    }
+
+    /// Texel weights are luminance times sin(theta), the solid angle a row
+    /// of the latitude-longitude map covers.
+    void build_distribution()
+    {
+      weight.resize(width * height);
+      conditional.resize(height * (width + 1));
+      marginal.resize(height + 1);
+      std::vector<double> row_sum(height);
+      double sum = 0;
+      for (int y = 0; y < height; y++)
+      {
+        float sin_theta = sinf(float(M_PI) * (y + 0.5f) / height);
+        double acc = 0;
+        for (int x = 0; x < width; x++)
+        {
+          const float *p = &rgb[3 * (y * width + x)];
+          float lum = 0.2126f * p[0] + 0.7152f * p[1] + 0.0722f * p[2];
+          weight[y * width + x] = std::max(0.0f, lum) * sin_theta;
+          acc += weight[y * width + x];
+        }
+        row_sum[y] = acc;
+        sum += acc;
+        float *row = &conditional[y * (width + 1)];
+        double run = 0;
+        row[0] = 0;
+        for (int x = 0; x < width; x++)
+        {
+          run += weight[y * width + x];
+          /// Black rows are never chosen, any valid CDF will do.
+          row[x + 1] = acc > 0 ? float(run / acc) : float(x + 1) / width;
+        }
+        row[width] = 1;
+      }
+      total = float(sum);
+      double run = 0;
+      marginal[0] = 0;
+      for (int y = 0; y < height; y++)
+      {
+        run += row_sum[y];
+        marginal[y + 1] = sum > 0 ? float(run / sum) : float(y + 1) / height;
+      }
+      marginal[height] = 1;
+    }
+
+    int width, height;
+    std::vector<float> rgb;         /* Linear radiance, row-major, top row first. */
+    std::vector<float> weight;      /* Sampling weight per texel. */
+    std::vector<float> conditional; /* Per row CDF over columns, width + 1 entries each. */
+    std::vector<float> marginal;    /* CDF over rows, height + 1 entries. */
+    float total;                    /* Sum of all weights. */
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef FILMH
+#define FILMH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <iostream>
+#include "vec3.h"
+#include "hitable.h"
+#include "util.h"
+#include "render.h"
+#include "output.h"
+#include "threads.h"
+
+#define CHECKPOINT_MAGIC "RTCK"
+#define CHECKPOINT_VERSION 4
+#define CHECKPOINT_INTERVAL_DEFAULT 60 /// Seconds between checkpoints
+
+/// Set by SIGINT/SIGTERM, asks a progressive render to checkpoint and stop.
+static volatile sig_atomic_t stop_requested = 0;
+
+/// @brief Signal handler recording the stop request.
+void request_stop(int sig)
+{
+  stop_requested = 1;
+}
+
+/// @brief Route SIGINT and SIGTERM to request_stop.
+void install_stop_handlers()
+{
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+}
+
+/// Fixed size header of a checkpoint file. It is followed by nX * nY
+/// uint32 sample counts and nX * nY linear color sums (3 floats each),
+/// both indexed [j * nX + i]. The random state needs no storage: sample s
+/// of a pixel always reseeds from (seed, i, j, s), so a pixel's count is
+/// also where its random stream resumes.
+typedef struct checkpoint_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t nX, nY, nS;
+  uint32_t seed;
+  uint32_t sampling;
+  view_params view;
+  float shutter;  /// Samples of different exposures cannot be mixed
+  uint64_t scene; /// checkpoint_scene_id of the scene, environment and texture
+} checkpoint_header;
+
+/// @brief Identify what a progressive render is of, for checkpoint headers.
+/// FNV-1a over the scene name, environment map path and texture path.
+uint64_t checkpoint_scene_id(const std::string &scene, const std::string &env, const std::string &texture)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const std::string *s : {&scene, &env, &texture})
+  {
+    /// The terminating NUL separates the strings, "ab"+"" differs from "a"+"b".
+    for (size_t k = 0; k <= s->size(); k++)
+    {
+      h = (h ^ (unsigned char) s->c_str()[k]) * 0x100000001b3ull;
+    }
+  }
+  return h;
+}
+
+/// Accumulation buffer class
+/// Linear per-pixel color sums and sample counts of a progressive render.
+class accum_buffer
+{
+  public:
+    /// @param scene_id checkpoint_scene_id of the rendered scene
+    accum_buffer(const frame_ctx &f, uint64_t scene_id = 0): frame(f), scene(scene_id)
+    {
+      size_t n = frame.nX * frame.nY;
+      sum = new vec3[n];
+      count = new uint32_t[n];
+      for (size_t k = 0; k < n; k++)
+      {
+        sum[k] = vec3(0,0,0);
+        count[k] = 0;
+      }
+    }
+    ~accum_buffer()
+    {
+      delete[] sum;
+      delete[] count;
+    }
+
+    inline size_t index(int i, int j) const { return j * frame.nX + i; }
+
+    /// @brief Bring pixel (i, j) up to target samples.
+    ///
+    /// Samples are added in index order, exactly as render_pixel does, so a
+    /// resumed render sums the same floats in the same order.
+    void accumulate(const scene *scn, int i, int j, uint32_t target)
+    {
+      size_t k = index(i, j);
+      for (; count[k] < target; count[k]++)
+      {
+        sum[k] += sample_pixel(scn, frame, i, j, count[k]);
+      }
+    }
+
+    /// @brief Smallest per-pixel sample count.
+    uint32_t min_count() const
+    {
+      size_t n = frame.nX * frame.nY;
+      uint32_t res = n ? count[0] : 0;
+      for (size_t k = 1; k < n; k++)
+      {
+        res = std::min(res, count[k]);
+      }
+      return res;
+    }
+
+    /// @brief Mean linear color of pixel (i, j), black before its first sample.
+    inline vec3 mean(int i, int j) const
+    {
+      size_t k = index(i, j);
+      return count[k] ? sum[k] / float(count[k]) : BLACK;
+    }
+
+    /// @brief Write the mean linear color of every pixel to image.
+    void resolve(vec3 **image) const
+    {
+      for (size_t j = 0; j < frame.nY; j++)
+      {
+        for (size_t i = 0; i < frame.nX; i++)
+        {
+          image[i][j] = mean(i, j);
+        }
+      }
+    }
+
+    /// @brief Copy the current mean colors into a standalone image.
+    image_buffer snapshot() const
+    {
+      image_buffer img(frame.nX, frame.nY);
+      for (size_t j = 0; j < frame.nY; j++)
+      {
+        for (size_t i = 0; i < frame.nX; i++)
+        {
+          img.set(i, j, mean(i, j));
+        }
+      }
+      return img;
+    }
+
+    /// @brief Atomically replace path with a checkpoint of this buffer.
+    /// @return true iff the checkpoint was written.
+    bool save(const std::string &path) const
+    {
+      checkpoint_header h;
+      header(h);
+      std::string tmp = path + ".tmp";
+      FILE *f = fopen(tmp.c_str(), "wb");
+      if (!f)
+      {
+        return false;
+      }
+      size_t n = frame.nX * frame.nY;
+      bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(count, sizeof(uint32_t), n, f) == n
+        && fwrite(sum, sizeof(vec3), n, f) == n;
+      ok = (fclose(f) == 0) && ok;
+      /// rename() keeps the previous checkpoint intact until the new one is complete.
+      return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    /// @brief Restore a checkpoint written by save().
+    /// @param err (OUT) reason for failure
+    /// @return true iff the checkpoint matches this frame and was read.
+    bool load(const std::string &path, std::string &err)
+    {
+      FILE *f = fopen(path.c_str(), "rb");
+      if (!f)
+      {
+        err = "cannot open " + path;
+        return false;
+      }
+      checkpoint_header h, expect;
+      header(expect);
+      size_t n = frame.nX * frame.nY;
+      bool ok = fread(&h, sizeof(h), 1, f) == 1;
+      if (!ok || memcmp(h.magic, expect.magic, 4) != 0 || h.version != expect.version)
+      {
+        err = path + " is not a checkpoint";
+      } else if (h.nX != expect.nX || h.nY != expect.nY || h.seed != expect.seed
+          || h.sampling != expect.sampling || memcmp(&h.view, &expect.view, sizeof(view_params)) != 0
+          || h.shutter != expect.shutter || h.scene != expect.scene)
+      {
+        /// nS may differ: resuming with more samples extends a finished render.
+        err = path + " was written for a different frame or scene";
+      } else if (fread(count, sizeof(uint32_t), n, f) != n || fread(sum, sizeof(vec3), n, f) != n)
+      {
+        err = path + " is truncated";
+      } else
+      {
+        err.clear();
+      }
+      fclose(f);
+      return err.empty();
+    }
+
+  private:
+    void header(checkpoint_header &h) const
+    {
+      memset((void *) &h, 0, sizeof(h));
+      memcpy(h.magic, CHECKPOINT_MAGIC, 4);
+      h.version = CHECKPOINT_VERSION;
+      h.nX = frame.nX;
+      h.nY = frame.nY;
+      h.nS = frame.nS;
+      h.seed = frame.seed;
+      h.sampling = frame.sampling;
+      h.view = frame.view;
+      h.shutter = frame.shutter;
+      h.scene = scene;
+    }
+
+    frame_ctx frame;
+    uint64_t scene;   /* Identifies the scene in checkpoints. */
+    vec3 *sum;        /* Linear color sum per pixel. */
+    uint32_t *count;  /* Samples in sum per pixel. */
+};
+
+/// @brief Progressively render until every pixel has frame.nS samples.
+///
+/// Each pass adds one sample per pixel, row by row on the shared pool. The
+/// buffer is checkpointed after a pass once interval seconds have passed.
+/// On a stop request the remaining rows of the pass are skipped, the
+/// partial buffer is checkpointed and the render returns early.
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param accum (IN/OUT) accumulation buffer, possibly resumed
+/// @param checkpoint checkpoint path, empty to disable checkpoints
+/// @param interval seconds between checkpoints
+/// @param on_pass optional callback after every completed pass, given the
+/// samples per pixel reached so far
+/// @return true iff the render completed.
+bool render_progressive(
+  const scene *scn,
+  const frame_ctx &frame,
+  accum_buffer &accum,
+  const std::string &checkpoint,
+  int interval,
+  std::function<void(uint32_t)> on_pass = NULL)
+{
+  typedef std::chrono::steady_clock clock;
+  clock::time_point last_save = clock::now();
+  for (uint32_t target = accum.min_count() + 1; target <= frame.nS && !stop_requested; target++)
+  {
+    task_group group;
+    group.add(frame.nY);
+    for (size_t j = 0; j < frame.nY; j++)
+    {
+      shared_pool().submit([&, j] {
+        if (!stop_requested)
+        {
+          for (size_t i = 0; i < frame.nX; i++)
+          {
+            accum.accumulate(scn, i, j, target);
+          }
+        }
+        group.done();
+      });
+    }
+    group.wait();
+    if (on_pass && !stop_requested)
+    {
+      on_pass(target);
+    }
+
+    if (!checkpoint.empty() && !stop_requested
+        && clock::now() - last_save >= std::chrono::seconds(interval))
+    {
+      if (!accum.save(checkpoint))
+      {
+        std::cerr << "Could not write checkpoint " << checkpoint << "\n";
+      }
+      last_save = clock::now();
+    }
+  }
+  if (stop_requested)
+  {
+    if (!checkpoint.empty() && accum.save(checkpoint))
+    {
+      std::cerr << "Stopped, progress saved to " << checkpoint << "\n";
+    }
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef GRIDH
+#define GRIDH
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+
+#define GRID_DENSITY 4           /// Cells per object the resolution aims for
+#define GRID_MAX_RES 1024        /// Largest resolution along one axis
+#define GRID_MAX_CELLS (1 << 25) /// Cap on the total number of cells
+#define GRID_MAILBOX 8           /// Recently tested objects skipped by a ray
+
+/// Build statistics, see grid::stats.
+typedef struct grid_stats
+{
+  double build_ms;  /// Wall time of the build
+  int res[3];       /// Cells along each axis
+  size_t cells, refs, empty;
+  size_t bytes;     /// Memory of the cell and reference arrays
+} grid_stats;
+
+/// Uniform grid class
+/// Owns a set of hitables and answers ray queries by walking the cells a ray
+/// crosses with a 3D-DDA (Amanatides & Woo 1987). Builds in linear time
+/// and suits many similar-sized objects spread evenly, where cells hold few
+/// objects and empty space is skipped cell by cell. Cells list their
+/// objects in one array, cell k owning refs[start[k]] to refs[start[k + 1]].
+class grid : public hitable
+{
+  public:
+    /// @brief Build over heap allocated objects, which the grid then owns.
+    grid(const std::vector<hitable *> &objects): prims(objects)
+    {
+      build();
+    }
+    virtual ~grid()
+    {
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        delete prims[i];
+      }
+    }
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    virtual bool occluded(const ray &r, float t_min, float t_max) const;
+    /// Objects finalize their own hits, rec.obj never points at the grid.
+    virtual void finalize(const ray &r, hit_record &rec) const { rec.obj->finalize(r, rec); }
+    virtual bool bounding_box(aabb &box) const
+    {
+      if (prims.empty())
+      {
+        return false;
+      }
+      box = bounds;
+      return true;
+    }
+
+    inline size_t size() const { return prims.size(); }
+    inline hitable *get(size_t i) const { return prims[i]; }
+    inline const grid_stats &stats() const { return build_stats; }
+
+  private:
+    /// Cells a ray crosses, in order, and the distance at which it leaves
+    /// the current one.
+    typedef struct grid_walk
+    {
+      int cell[3], step[3], out[3];
+      float next[3], delta[3];
+
+      inline float exit() const { return fminf(next[0], fminf(next[1], next[2])); }
+
+      /// @brief Move to the next cell.
+      /// @return false once the ray leaves the grid.
+      inline bool advance()
+      {
+        int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        cell[a] += step[a];
+        next[a] += delta[a];
+        return cell[a] != out[a];
+      }
+    } grid_walk;
+
+    /// Objects a ray has already tested, the last GRID_MAILBOX of them.
+    typedef struct grid_mailbox
+    {
+      uint32_t ids[GRID_MAILBOX];
+      int count = 0;
+
+      /// @brief Check for object i and remember it if it is new.
+      inline bool seen(uint32_t i)
+      {
+        for (int k = 0; k < std::min(count, GRID_MAILBOX); k++)
+        {
+          if (ids[k] == i)
+          {
+            return true;
+          }
+        }
+        ids[count++ % GRID_MAILBOX] = i;
+        return false;
+      }
+    } grid_mailbox;
+
+    void build()
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::vector<aabb> boxes(prims.size());
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        prims[i]->bounding_box(boxes[i]);
+        bounds.extend(boxes[i]);
+      }
+      choose_resolution();
+      /// Count the references of every cell, turn the counts into offsets,
+      /// then fill each cell in place.
+      size_t cells = size_t(res[0]) * res[1] * res[2];
+      cell_start.assign(cells + 1, 0);
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        int lo[3], hi[3];
+        cell_range(boxes[i], lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+          for (int y = lo[1]; y <= hi[1]; y++)
+            for (int x = lo[0]; x <= hi[0]; x++)
+            {
+              cell_start[index(x, y, z) + 1]++;
+            }
+      }
+      for (size_t k = 0; k < cells; k++)
+      {
+        cell_start[k + 1] += cell_start[k];
+      }
+      refs.resize(cell_start[cells]);
+      std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+      for (size_t i = 0; i < prims.size(); i++)
+      {
+        int lo[3], hi[3];
+        cell_range(boxes[i], lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+          for (int y = lo[1]; y <= hi[1]; y++)
+            for (int x = lo[0]; x <= hi[0]; x++)
+            {
+              refs[fill[index(x, y, z)]++] = i;
+            }
+      }
+      std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+      build_stats.build_ms = took.count();
+      std::copy(res, res + 3, build_stats.res);
+      build_stats.cells = cells;
+      build_stats.refs = refs.size();
+      build_stats.empty = 0;
+      for (size_t k = 0; k < cells; k++)
+      {
+        build_stats.empty += cell_start[k] == cell_start[k + 1];
+      }
+      build_stats.bytes = cell_start.size() * sizeof(uint32_t) + refs.size() * sizeof(uint32_t);
+    }
+
+    /// @brief Pick cubic-ish cells so the grid has about GRID_DENSITY cells
+    /// per object, never fewer than one cell along an axis.
+    void choose_resolution()
+    {
+      vec3 extent = prims.empty() ? vec3(0, 0, 0) : bounds.extent();
+      float longest = std::max(extent[0], std::max(extent[1], extent[2]));
+      /// Flat or degenerate axes still get a thin slab of volume.
+      float floor_extent = std::max(longest * 1e-3f, 1e-6f);
+      float volume = 1;
+      for (int a = 0; a < 3; a++)
+      {
+        volume *= std::max(extent[a], floor_extent);
+      }
+      float per_unit = cbrtf(GRID_DENSITY * std::max<size_t>(prims.size(), 1) / volume);
+      for (int a = 0; a < 3; a++)
+      {
+        res[a] = std::max(1, std::min(GRID_MAX_RES, int(std::max(extent[a], floor_extent) * per_unit)));
+      }
+      while (size_t(res[0]) * res[1] * res[2] > GRID_MAX_CELLS)
+      {
+        for (int a = 0; a < 3; a++)
+        {
+          res[a] = std::max(1, res[a] / 2);
+        }
+      }
+      for (int a = 0; a < 3; a++)
+      {
+        cell_size[a] = std::max(extent[a], floor_extent) / res[a];
+        inv_cell[a] = 1 / cell_size[a];
+      }
+    }
+
+    inline int cell_of(float x, int a) const
+    {
+      return std::max(0, std::min(res[a] - 1, int((x - bounds.min[a]) * inv_cell[a])));
+    }
+
+    inline void cell_range(const aabb &box, int lo[3], int hi[3]) const
+    {
+      for (int a = 0; a < 3; a++)
+      {
+        lo[a] = cell_of(box.min[a], a);
+        hi[a] = cell_of(box.max[a], a);
+      }
+    }
+
+    inline size_t index(int x, int y, int z) const
+    {
+      return (size_t(z) * res[1] + y) * res[0] + x;
+    }
+
+    /// @brief Set up the walk of r from where it enters the grid.
+    /// @return false if r misses the grid within (t_min, t_max).
+    bool start_walk(const ray &r, float t_min, float t_max, grid_walk &w) const
+    {
+      if (prims.empty())
+      {
+        return false;
+      }
+      vec3 origin = r.origin(), dir = r.direction();
+      vec3 inv_dir = vec3(1, 1, 1) / dir;
+      float t0 = t_min, t1 = t_max;
+      for (int a = 0; a < 3; a++)
+      {
+        float near = (bounds.min[a] - origin[a]) * inv_dir[a];
+        float far = (bounds.max[a] - origin[a]) * inv_dir[a];
+        t0 = fmaxf(t0, fminf(near, far));
+        t1 = fminf(t1, fmaxf(near, far));
+      }
+      if (t0 > t1)
+      {
+        return false;
+      }
+      for (int a = 0; a < 3; a++)
+      {
+        w.cell[a] = cell_of(origin[a] + t0 * dir[a], a);
+        float low = bounds.min[a] + w.cell[a] * cell_size[a];
+        if (dir[a] > 0)
+        {
+          w.step[a] = 1;
+          w.out[a] = res[a];
+          w.next[a] = (low + cell_size[a] - origin[a]) * inv_dir[a];
+          w.delta[a] = cell_size[a] * inv_dir[a];
+        } else if (dir[a] < 0)
+        {
+          w.step[a] = -1;
+          w.out[a] = -1;
+          w.next[a] = (low - origin[a]) * inv_dir[a];
+          w.delta[a] = -cell_size[a] * inv_dir[a];
+        } else
+        {
+          w.step[a] = 0;
+          w.out[a] = -1;
+          w.next[a] = INFINITY;
+          w.delta[a] = INFINITY;
+        }
+      }
+      return true;
+    }
+
+    std::vector<hitable *> prims;     /* Owned objects. */
+    std::vector<uint32_t> cell_start; /* Offset of each cell's references, plus the total. */
+    std::vector<uint32_t> refs;       /* Object indices, grouped by cell. */
+    aabb bounds;
+    int res[3];
+    vec3 cell_size, inv_cell;
+    grid_stats build_stats;
+};
+
+/// @brief Closest hit. Cells are visited front to back; objects in a cell
+/// are tested over the whole segment, so the walk ends as soon as a hit
+/// lies before the exit of the current cell. Objects spanning several
+/// cells are tested once thanks to a small mailbox.
+bool grid::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+{
+  grid_walk w;
+  if (!start_walk(r, t_min, t_max, w))
+  {
+    return false;
+  }
+  grid_mailbox mail;
+  bool did_hit = false;
+  do
+  {
+    size_t k = index(w.cell[0], w.cell[1], w.cell[2]);
+    for (uint32_t j = cell_start[k]; j < cell_start[k + 1]; j++)
+    {
+      uint32_t i = refs[j];
+      if (mail.seen(i))
+      {
+        continue;
+      }
+      if (prims[i]->hit(r, t_min, t_max, rec))
+      {
+        did_hit = true;
+        t_max = rec.t;
+      }
+    }
+  } while (t_max > w.exit() && w.advance());
+  return did_hit;
+}
+
+/// @brief Any hit, returns at the first object blocking the segment.
+bool grid::occluded(const ray &r, float t_min, float t_max) const
+{
+  grid_walk w;
+  if (!start_walk(r, t_min, t_max, w))
+  {
+    return false;
+  }
+  grid_mailbox mail;
+  do
+  {
+    size_t k = index(w.cell[0], w.cell[1], w.cell[2]);
+    for (uint32_t j = cell_start[k]; j < cell_start[k + 1]; j++)
+    {
+      uint32_t i = refs[j];
+      if (mail.seen(i))
+      {
+        continue;
+      }
+      if (prims[i]->occluded(r, t_min, t_max))
+      {
+        return true;
+      }
+    }
+  } while (t_max > w.exit() && w.advance());
+  return false;
+}
+
+#endif
@@ -4,19 +4,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ray.h"
+#include "aabb.h"
 #include "assert.h"
 #define DEFAULT_SIZE 8
 using namespace std;
 
 class material;
+class hitable;
 
-/* Records normal, position, light ray's t in order to compute textures. */
+/* Records normal, position, light ray's t in order to compute textures.
+   Traversal only fills t and obj; p, normal and mat are computed once for
+   the closest hit by hitable::finalize. */
 typedef struct hit_record
 {
   float t;
+  const hitable *obj;
+  const hitable *prim;  /// Object hit inside an instance, see instance::hit
   vec3 p;
   vec3 normal;
   material *mat;
+  float u, v;  /// Surface texture coordinates
+  float duv;   /// Ray cone footprint in texture coordinates
 } hit_record;
 
 /* Parent class of hitable objects. Hit method overloaded by children.*/
@@ -25,8 +33,19 @@ class hitable
   public:
     /// Generic destructor
     virtual ~hitable() {}
-    /// Generic hit function.
+    /// Generic hit function, records only t and the object hit.
     virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const = 0;
+    /// Complete a record produced by hit with position, normal and material.
+    virtual void finalize(const ray &r, hit_record &rec) const = 0;
+    /// World space bounds, false for objects without finite bounds.
+    virtual bool bounding_box(aabb &box) const = 0;
+    /// Any-hit query: true iff the ray hits the object within (t_min, t_max).
+    /// Children override it to skip computing a hit record.
+    virtual bool occluded(const ray &r, float t_min, float t_max) const
+    {
+      hit_record rec;
+      return hit(r, t_min, t_max, rec);
+    }
 };
 
 /* Stores a heap allocated list of hitable objects. Can be queried with a ray. */
@@ -37,6 +56,7 @@ class hit_list
     ~hit_list();
     void push(hitable *h);
     bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    bool occluded(const ray &r, float t_min, float t_max) const;
     inline hitable * get(int i) const  { assert(i< list_size); return list[i]; }
     inline int size() const  { return list_size; }
     inline void destroy() {free(list); list = NULL; list_size = list_length = 0; }
@@ -64,7 +84,7 @@ hit_list::~hit_list()
   {
     delete list[i];
   }
-  delete list;
+  delete[] list;
 }
 
 /// @brief Push to hit list.
@@ -80,7 +100,7 @@ void hit_list::push(hitable *h)
     memset(new_list, 0xff, list_length * sizeof( hitable *));
     /// Copy over hitable pointers to new list.
     memcpy(new_list, list, list_size * sizeof(hitable *));
-    delete list;
+    delete[] list;
     list = new_list;
   }
   // Add to list.
@@ -99,20 +119,38 @@ bool hit_list::hit(const ray &r, float t_min, float t_max, hit_record &rec) cons
 {
   float t_closest = t_max;
   bool did_hit =  false;
-  hit_record temp_record;
   for (int i = 0; i < list_size; i ++)
   {
-    // cout << i << " " <<  list_size << " " << list << '\n';
-    hitable *h = list[i];
-    // cout << "dereferenced " << h << "\n";
-    if (h->hit(r, t_min, t_closest, temp_record))
+    /// Objects only write t and obj, and only for a closer hit.
+    if (list[i]->hit(r, t_min, t_closest, rec))
     {
       did_hit = true;
-      rec = temp_record;
       t_closest = rec.t;
     }
   }
+  if (did_hit)
+  {
+    /// Shade data is computed for the winning hit only.
+    rec.obj->finalize(r, rec);
+  }
   return did_hit;
 }
 
+/// @brief Any-hit query for shadow rays.
+///
+/// Stops at the first object hit within (t_min, t_max) instead of looking
+/// for the closest one, and never writes a hit record.
+/// @return true iff some object blocks the ray segment.
+bool hit_list::occluded(const ray &r, float t_min, float t_max) const
+{
+  for (int i = 0; i < list_size; i ++)
+  {
+    if (list[i]->occluded(r, t_min, t_max))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#ifndef INSTANCEH
+#define INSTANCEH
+
+#include <math.h>
+#include <memory>
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+
+/// Affine transform x' = M x + t, stored as a 3x4 matrix.
+typedef struct affine
+{
+  float m[3][4];
+
+  /// @brief Identity transform.
+  affine()
+  {
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 4; c++)
+      {
+        m[r][c] = r == c;
+      }
+    }
+  }
+
+  /// @brief Uniform scale s, rotation by angle radians about +y, then translation t.
+  static affine place(const vec3 &t, float angle, float s)
+  {
+    affine a;
+    float c = cosf(angle) * s, n = sinf(angle) * s;
+    a.m[0][0] = c;  a.m[0][1] = 0; a.m[0][2] = n;  a.m[0][3] = t.x();
+    a.m[1][0] = 0;  a.m[1][1] = s; a.m[1][2] = 0;  a.m[1][3] = t.y();
+    a.m[2][0] = -n; a.m[2][1] = 0; a.m[2][2] = c;  a.m[2][3] = t.z();
+    return a;
+  }
+
+  inline vec3 point(const vec3 &p) const
+  {
+    return vec3(
+      m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+      m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+      m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+  }
+
+  inline vec3 vector(const vec3 &v) const
+  {
+    return vec3(
+      m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+      m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+      m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+
+  /// @brief Apply the transposed linear part, maps normals with the inverse.
+  inline vec3 transposed(const vec3 &v) const
+  {
+    return vec3(
+      m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+      m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+      m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+  }
+
+  inline float determinant() const
+  {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+         - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+         + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  /// @brief Inverse transform, the linear part must be invertible.
+  affine inverse() const
+  {
+    affine inv;
+    float d = 1 / determinant();
+    inv.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * d;
+    inv.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * d;
+    inv.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * d;
+    inv.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * d;
+    inv.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * d;
+    inv.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * d;
+    inv.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * d;
+    inv.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * d;
+    inv.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * d;
+    vec3 t = inv.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    inv.m[0][3] = -t[0];
+    inv.m[1][3] = -t[1];
+    inv.m[2][3] = -t[2];
+    return inv;
+  }
+} affine;
+
+/// Instance class
+/// Places shared geometry in the world with an affine transform. The
+/// geometry, typically a bvh of its own (the bottom level), is referenced,
+/// not copied, so every instance only costs its transforms and bounds. A
+/// bvh over many instances forms the top level.
+///
+/// Instances do not nest: the hit record has a single slot (prim) for the
+/// object hit inside the instance.
+class instance : public hitable
+{
+  public:
+    /// @param geom shared geometry in its own local space
+    /// @param to_world local to world transform
+    instance(const std::shared_ptr<const hitable> &geom, const affine &to_world):
+      object(geom), world(to_world), local(to_world.inverse())
+    {
+      scale = cbrtf(fabsf(to_world.determinant()));
+      aabb lb;
+      if (object->bounding_box(lb))
+      {
+        /// World bounds of the eight transformed corners.
+        for (int k = 0; k < 8; k++)
+        {
+          bounds.extend(world.point(vec3(
+            k & 1 ? lb.max[0] : lb.min[0],
+            k & 2 ? lb.max[1] : lb.min[1],
+            k & 4 ? lb.max[2] : lb.min[2])));
+        }
+      }
+    }
+    virtual ~instance() {}
+
+    /// Rays are moved into local space; an affine map keeps t unchanged.
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+    {
+      if (!object->hit(to_local(r), t_min, t_max, rec))
+      {
+        return false;
+      }
+      rec.prim = rec.obj;
+      rec.obj = this;
+      return true;
+    }
+
+    virtual bool occluded(const ray &r, float t_min, float t_max) const
+    {
+      return object->occluded(to_local(r), t_min, t_max);
+    }
+
+    virtual void finalize(const ray &r, hit_record &rec) const
+    {
+      rec.prim->finalize(to_local(r), rec);
+      rec.p = world.point(rec.p);
+      /// Normals transform with the inverse transpose.
+      rec.normal = unit_vector(local.transposed(rec.normal));
+    }
+
+    virtual bool bounding_box(aabb &box) const
+    {
+      box = bounds;
+      return true;
+    }
+
+  private:
+    inline ray to_local(const ray &r) const
+    {
+      ray l(local.point(r.origin()), local.vector(r.direction()), r.time);
+      l.width = r.width / scale;
+      l.spread = r.spread / scale;
+      return l;
+    }
+
+    std::shared_ptr<const hitable> object; /* Shared geometry. */
+    affine world;  /* Local to world. */
+    affine local;  /* World to local. */
+    float scale;   /* Mean scale factor of the transform, for ray cones. */
+    aabb bounds;   /* World space bounds. */
+};
+
+#endif
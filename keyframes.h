@@ -0,0 +1,88 @@
+#ifndef KEYFRAMESH
+#define KEYFRAMESH
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+#include "vec3.h"
+#include "util.h"
+
+/// Keyframe track class
+/// Values at increasing times, linearly interpolated in between and held
+/// constant before the first and after the last key.
+template <class T>
+class track
+{
+  public:
+    /// @brief Add a key, keeping the keys sorted by time.
+    void add(float time, const T &value)
+    {
+      std::pair<float, T> key(time, value);
+      keys.insert(std::upper_bound(keys.begin(), keys.end(), key,
+        [](const std::pair<float, T> &a, const std::pair<float, T> &b) { return a.first < b.first; }), key);
+    }
+
+    inline bool empty() const { return keys.empty(); }
+
+    /// @brief Interpolated value at time, the track must not be empty.
+    T at(float time) const
+    {
+      if (time <= keys.front().first)
+      {
+        return keys.front().second;
+      }
+      if (time >= keys.back().first)
+      {
+        return keys.back().second;
+      }
+      size_t k = 1;
+      while (keys[k].first < time)
+      {
+        k++;
+      }
+      const std::pair<float, T> &a = keys[k - 1], &b = keys[k];
+      float w = (time - a.first) / (b.first - a.first);
+      return (1 - w) * a.second + w * b.second;
+    }
+
+  private:
+    std::vector<std::pair<float, T>> keys;
+};
+
+/// Keyframed camera placement.
+typedef struct view_track
+{
+  track<vec3> lookfrom, lookat, vup;
+  track<float> vfov;
+
+  /// @brief Add every parameter of v as a key at time.
+  void add(float time, const view_params &v)
+  {
+    lookfrom.add(time, v.lookfrom);
+    lookat.add(time, v.lookat);
+    vup.add(time, v.vup);
+    vfov.add(time, v.vfov);
+  }
+
+  /// @brief Camera placement at time, fallback if there are no keys.
+  view_params at(float time, const view_params &fallback) const
+  {
+    if (lookfrom.empty())
+    {
+      return fallback;
+    }
+    view_params v;
+    v.lookfrom = lookfrom.at(time);
+    v.lookat = lookat.at(time);
+    v.vup = vup.at(time);
+    v.vfov = vfov.at(time);
+    return v;
+  }
+} view_track;
+
+/// Keyframed centers of a scene's top-level spheres, by their index in
+/// the scene's world.
+typedef std::map<int, track<vec3>> object_keys;
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "vec3.h"
+#include "ray.h"
+#include "hitable.h"
+#include "sphere.h"
+#include "materials.h"
+
+/// Direction towards a light, produced by light_list::sample.
+typedef struct light_sample
+{
+  vec3 wi;        /// Unit direction from the shading point to the light
+  float dist;     /// Distance along wi to the light surface
+  float pdf;      /// Solid angle density of wi, light selection included
+  vec3 radiance;  /// Radiance emitted towards the shading point
+} light_sample;
+
+/// Emissive spheres of a scene, sampled for next-event estimation.
+class light_list
+{
+  public:
+    void push(const sphere *s)
+    {
+      spheres.push_back(s);
+      members.insert(std::lower_bound(members.begin(), members.end(), s), s);
+    }
+    inline size_t size() const { return spheres.size(); }
+    inline bool empty() const { return spheres.empty(); }
+    /// @brief Whether obj is sampled by sample(). Emitters that are not must
+    /// still be counted when a path hits them.
+    inline bool contains(const hitable *obj) const
+    {
+      return std::binary_search(members.begin(), members.end(), obj);
+    }
+
+    /// @brief Sample a direction towards one light, picked uniformly.
+    ///
+    /// Directions are drawn uniformly from the cone the sphere subtends as
+    /// seen from p, so every sample lands on the light and the density is
+    /// constant over the cone.
+    /// @param p shading point
+    /// @param u0 selects the light
+    /// @param u1 u2 position within the cone
+    /// @param ls (OUT) sampled direction
+    /// @return false if p lies inside the chosen light.
+    bool sample(const vec3 &p, float u0, float u1, float u2, light_sample &ls) const
+    {
+      size_t n = spheres.size();
+      const sphere *s = spheres[std::min(n - 1, size_t(u0 * n))];
+      vec3 to_center = s->center - p;
+      float d2 = to_center.squared_length();
+      float r2 = s->rad * s->rad;
+      if (d2 <= r2)
+      {
+        return false;
+      }
+      float d = sqrtf(d2);
+      vec3 w = to_center / d;
+      float cos_max = sqrtf(1 - r2 / d2);
+      float cos_theta = 1 - u1 * (1 - cos_max);
+      float sin_theta = sqrtf(fmaxf(0, 1 - cos_theta * cos_theta));
+      float phi = 2 * float(M_PI) * u2;
+      vec3 t, bt;
+      make_basis(w, t, bt);
+      ls.wi = unit_vector(sin_theta * cosf(phi) * t + sin_theta * sinf(phi) * bt + cos_theta * w);
+      /// Nearest intersection of the sampled direction with the sphere.
+      float b = dot(ls.wi, to_center);
+      ls.dist = b - sqrtf(fmaxf(0, b * b - (d2 - r2)));
+      ls.pdf = 1 / (2 * float(M_PI) * (1 - cos_max) * n);
+      ls.radiance = s->mat->emitted();
+      return true;
+    }
+
+  private:
+    std::vector<const sphere *> spheres;
+    std::vector<const hitable *> members;  /* The spheres, sorted by address. */
+};
+
+#endif
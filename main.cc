@@ -2,6 +2,7 @@
 #include <fstream>
 #include <algorithm>
 #include <stdlib.h>
+#include <getopt.h>
 #include "ray.h"
 #include "vec3.h"
 #include "sphere.h"
@@ -9,218 +10,396 @@
 #include "util.h"
 #include "camera.h"
 #include "materials.h"
+#include "render.h"
+#include "scenes.h"
+#include "output.h"
+#include "server.h"
+#include "distrib.h"
+#include "film.h"
+#include "stream.h"
+#include "bench.h"
+#include "animation.h"
+#include "preview.h"
+#include "denoise.h"
 #include "float.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
 using namespace std;
 
-/// @brief return pixel color by querying world for a given light ray.
-/// @param r incoming light ray
-/// @param world list of hitable objects that produce colors when hit by the light ray.
-/// @param depth used to ensure light rays don't scatter infinitely.
-vec3 color(const ray &r, const hit_list *world, int depth)
+/// @brief Print command line options.
+void usage(const char *prog)
 {
-  // Initialize hit record.
-  hit_record rec;
-  // Compute hitpoint.
-  bool hit = world->hit(r, 0.0001, MAXFLOAT, rec);
-  if (hit)
-  {
-    /// Attempt to scatter light ray given depth required.
-    ray scattered;
-    vec3 attenuation;
-    if (depth < 50 && rec.mat->scatter(r, rec, attenuation, scattered))
+  cerr << "Usage: " << prog << " [options]\n"
+       << "  -o, --output FILE     output image, .ppm, .png or .hdr (default file.ppm)\n"
+       << "  -W, --width N         horizontal resolution\n"
+       << "  -H, --height N        vertical resolution\n"
+       << "  -s, --spp N           samples per pixel\n"
+       << "      --seed N          seed for per-sample random streams\n"
+       << "      --sampler NAME    random, stratified, sobol or bluenoise (default random)\n"
+       << "      --scene NAME      registered scene to render\n"
+       << "      --env FILE        light the scene with an equirectangular .hdr map\n"
+       << "      --texture FILE    image mapped onto the spheres of the textured scene\n"
+       << "      --texture-budget MB\n"
+       << "                        resident texture tile memory (default " << TEXTURE_BUDGET_DEFAULT << ")\n"
+       << "      --lookfrom X,Y,Z  camera origin\n"
+       << "      --lookat X,Y,Z    camera target\n"
+       << "      --vup X,Y,Z       camera up vector\n"
+       << "      --vfov DEG        vertical field of vision\n"
+       << "      --shutter F       motion blur over fraction F of a frame interval (0 to 1)\n"
+       << "  -t, --threads N       render threads (default: all cores)\n"
+       << "  -d, --daemon ADDR     serve render jobs on a Unix socket or host:port\n"
+       << "                        (\":port\" listens on loopback only)\n"
+       << "      --out-dir DIR     directory the daemon writes job images to (default .)\n"
+       << "  -j, --submit ADDR     send this job to a running daemon\n"
+       << "  -p, --priority N      job priority when submitting\n"
+       << "      --workers A,B,..  render tiles on these daemons and assemble locally\n"
+       << "      --tile N          tile size for --workers (default " << TILE_SIZE_DEFAULT << ")\n"
+       << "      --checkpoint FILE progressively render, saving progress to FILE\n"
+       << "      --checkpoint-interval SEC\n"
+       << "                        seconds between checkpoints (default " << CHECKPOINT_INTERVAL_DEFAULT << ")\n"
+       << "      --resume          continue from the --checkpoint file\n"
+       << "      --snapshot N      with --checkpoint, write the output every N passes\n"
+       << "      --preview NAME    progressively render, publishing every pass to shared\n"
+       << "                        memory segment NAME\n"
+       << "      --denoise         filter the image guided by albedo, normal and depth\n"
+       << "                        (plain renders only, like --features)\n"
+       << "      --features        also write the albedo, normal and depth buffers,\n"
+       << "                        as OUTPUT_albedo.EXT and so on\n"
+       << "      --dither          ordered dithering when writing 8-bit images\n"
+       << "      --view NAME       show the --preview segment NAME in the terminal\n"
+       << "      --stream          write rows as they finish (.png or .ppm output)\n"
+       << "      --band N          rows rendered per streamed band (default " << BAND_ROWS_DEFAULT << ")\n"
+       << "      --bvh METHOD      bvh construction: sah, lbvh or median (default sah)\n"
+       << "      --bvh-quantize    store bvh bounds in 8 bits, halving node memory\n"
+       << "      --sort-rays       trace bounces in batches sorted by ray direction and origin\n"
+       << "      --accel KIND      hold large object sets in a bvh or a grid instead of\n"
+       << "                        the scene's own choice\n"
+       << "      --frames A:B      render animation frames A to B (output gets _NNNN appended\n"
+       << "                        unless it contains %d or %0Nd)\n"
+       << "      --key \"F FIELDS\" camera keyframe at frame F, FIELDS as in a job line:\n"
+       << "                        from=X,Y,Z at=X,Y,Z up=X,Y,Z fov=DEG\n"
+       << "                        or object keyframe: obj=N center=X,Y,Z moves the\n"
+       << "                        scene's Nth top-level object, which must be a sphere\n"
+       << "      --bench           run the benchmark suite and exit\n"
+       << "  -h, --help            show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+  enum { OPT_SEED = 256, OPT_SAMPLER, OPT_SCENE, OPT_LOOKFROM, OPT_LOOKAT, OPT_VUP, OPT_VFOV, OPT_WORKERS, OPT_TILE,
+    OPT_CHECKPOINT, OPT_INTERVAL, OPT_RESUME, OPT_STREAM, OPT_BAND,
+    OPT_SNAPSHOT, OPT_BENCH, OPT_ENV, OPT_TEXTURE, OPT_TEXTURE_BUDGET,
+    OPT_FRAMES, OPT_KEY, OPT_BVH, OPT_BVH_QUANTIZE, OPT_ACCEL, OPT_SORT_RAYS,
+    OPT_PREVIEW, OPT_VIEW, OPT_DENOISE, OPT_FEATURES, OPT_DITHER, OPT_SHUTTER, OPT_OUT_DIR };
+  static const struct option options[] = {
+    {"output",   required_argument, NULL, 'o'},
+    {"width",    required_argument, NULL, 'W'},
+    {"height",   required_argument, NULL, 'H'},
+    {"spp",      required_argument, NULL, 's'},
+    {"seed",     required_argument, NULL, OPT_SEED},
+    {"sampler",  required_argument, NULL, OPT_SAMPLER},
+    {"scene",    required_argument, NULL, OPT_SCENE},
+    {"env",      required_argument, NULL, OPT_ENV},
+    {"texture",  required_argument, NULL, OPT_TEXTURE},
+    {"texture-budget", required_argument, NULL, OPT_TEXTURE_BUDGET},
+    {"lookfrom", required_argument, NULL, OPT_LOOKFROM},
+    {"lookat",   required_argument, NULL, OPT_LOOKAT},
+    {"vup",      required_argument, NULL, OPT_VUP},
+    {"vfov",     required_argument, NULL, OPT_VFOV},
+    {"shutter",  required_argument, NULL, OPT_SHUTTER},
+    {"threads",  required_argument, NULL, 't'},
+    {"daemon",   required_argument, NULL, 'd'},
+    {"out-dir",  required_argument, NULL, OPT_OUT_DIR},
+    {"submit",   required_argument, NULL, 'j'},
+    {"priority", required_argument, NULL, 'p'},
+    {"workers",  required_argument, NULL, OPT_WORKERS},
+    {"tile",     required_argument, NULL, OPT_TILE},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"checkpoint-interval", required_argument, NULL, OPT_INTERVAL},
+    {"resume",   no_argument,       NULL, OPT_RESUME},
+    {"stream",   no_argument,       NULL, OPT_STREAM},
+    {"band",     required_argument, NULL, OPT_BAND},
+    {"snapshot", required_argument, NULL, OPT_SNAPSHOT},
+    {"preview",  required_argument, NULL, OPT_PREVIEW},
+    {"view",     required_argument, NULL, OPT_VIEW},
+    {"denoise",  no_argument,       NULL, OPT_DENOISE},
+    {"features", no_argument,       NULL, OPT_FEATURES},
+    {"dither",   no_argument,       NULL, OPT_DITHER},
+    {"bvh",      required_argument, NULL, OPT_BVH},
+    {"bvh-quantize", no_argument,   NULL, OPT_BVH_QUANTIZE},
+    {"accel",    required_argument, NULL, OPT_ACCEL},
+    {"sort-rays", no_argument,      NULL, OPT_SORT_RAYS},
+    {"frames",   required_argument, NULL, OPT_FRAMES},
+    {"key",      required_argument, NULL, OPT_KEY},
+    {"bench",    no_argument,       NULL, OPT_BENCH},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  render_job job;
+  initialize_job(job);
+  const char *daemon_socket = NULL;
+  const char *out_dir = ".";
+  const char *submit_socket = NULL;
+  const char *worker_list = NULL;
+  int tile_size = TILE_SIZE_DEFAULT;
+  std::string checkpoint;
+  int checkpoint_interval = CHECKPOINT_INTERVAL_DEFAULT;
+  bool resume = false;
+  bool stream = false;
+  int band_rows = BAND_ROWS_DEFAULT;
+  int snapshot = 0;
+  std::string preview, view;
+  bool denoise = false, features = false;
+  bool bench = false;
+  int first_frame = 0, last_frame = -1;
+  std::vector<const char *> keys;
+  bool ok = true;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:W:H:s:t:d:j:p:h", options, NULL)) != -1)
+  {
+    switch (opt)
     {
-      /// Scatter light ray according to material recorded in hit record.
-      return attenuation * color(scattered, world, depth + 1);
-    } else 
+      case 'o': job.out = optarg; break;
+      case 'W': ok = parse_count(optarg, MAX_RESOLUTION, job.frame.nX); break;
+      case 'H': ok = parse_count(optarg, MAX_RESOLUTION, job.frame.nY); break;
+      case 's': ok = parse_count(optarg, MAX_SAMPLES, job.frame.nS); break;
+      case OPT_SEED: job.frame.seed = strtoul(optarg, NULL, 10); break;
+      case OPT_SAMPLER: ok = (job.frame.sampling = parse_sampler(optarg)) >= 0; break;
+      case OPT_SCENE: job.scene = optarg; break;
+      case OPT_ENV: job.env = optarg; break;
+      case OPT_TEXTURE: job.texture = optarg; break;
+      case OPT_TEXTURE_BUDGET: ok = parse_count(optarg, TEXTURE_BUDGET_MAX, texture_budget_mb); break;
+      case OPT_LOOKFROM: ok = parse_vec3(optarg, job.frame.view.lookfrom); break;
+      case OPT_LOOKAT: ok = parse_vec3(optarg, job.frame.view.lookat); break;
+      case OPT_VUP: ok = parse_vec3(optarg, job.frame.view.vup); break;
+      case OPT_VFOV: ok = (job.frame.view.vfov = atof(optarg)) > 0; break;
+      case OPT_SHUTTER:
+        job.frame.shutter = atof(optarg);
+        ok = job.frame.shutter >= 0 && job.frame.shutter <= 1;
+        break;
+      case 't': pool_threads = atoi(optarg); break;
+      case 'd': daemon_socket = optarg; break;
+      case OPT_OUT_DIR: out_dir = optarg; break;
+      case 'j': submit_socket = optarg; break;
+      case 'p': job.priority = atoi(optarg); break;
+      case OPT_WORKERS: worker_list = optarg; break;
+      case OPT_TILE: ok = (tile_size = atoi(optarg)) > 0; break;
+      case OPT_CHECKPOINT: checkpoint = optarg; break;
+      case OPT_INTERVAL: ok = (checkpoint_interval = atoi(optarg)) >= 0; break;
+      case OPT_RESUME: resume = true; break;
+      case OPT_STREAM: stream = true; break;
+      case OPT_BAND: ok = (band_rows = atoi(optarg)) > 0; break;
+      case OPT_SNAPSHOT: ok = (snapshot = atoi(optarg)) > 0; break;
+      case OPT_PREVIEW: preview = optarg; break;
+      case OPT_VIEW: view = optarg; break;
+      case OPT_DENOISE: denoise = true; break;
+      case OPT_FEATURES: features = true; break;
+      case OPT_DITHER: dither_output = true; break;
+      case OPT_FRAMES:
+        ok = sscanf(optarg, "%d:%d", &first_frame, &last_frame) == 2 && first_frame <= last_frame;
+        break;
+      case OPT_KEY: keys.push_back(optarg); break;
+      case OPT_BVH: ok = (bvh_default = parse_bvh(optarg)) >= 0; break;
+      case OPT_BVH_QUANTIZE: bvh_quantize = true; break;
+      case OPT_ACCEL: ok = (accel_override = parse_accel(optarg)) >= 0; break;
+      case OPT_SORT_RAYS: sort_rays = true; break;
+      case OPT_BENCH: bench = true; break;
+      case 'h': usage(argv[0]); return 0;
+      default: ok = false;
+    }
+    if (!ok)
     {
-      /// Max depth was exceeded, or light was absorbed! 
-      /// Return black pixel to signify shadow.
-      return vec3(0,0,0);
+      usage(argv[0]);
+      return 1;
     }
-  } else
+  }
+  if (resume && checkpoint.empty())
   {
-    // Background compute.
-    vec3 uv = unit_vector(r.direction()); 
-    float t = 0.5 * (uv.y() + 1);
-    /// Evenly blend sky blue and white along the ray direction's y axis.
-    return (1 - t) * WHITE + (t) * SKYBLUE;
+    cerr << "--resume needs --checkpoint\n";
+    return 1;
+  }
+  if (stream && !checkpoint.empty())
+  {
+    cerr << "--stream cannot be combined with --checkpoint\n";
+    return 1;
+  }
+  if (stream && !preview.empty())
+  {
+    cerr << "--stream cannot be combined with --preview\n";
+    return 1;
+  }
+  /// The feature buffers are rendered after the finished image, which only the plain render path has.
+  const char *mode = stream ? "--stream" : !checkpoint.empty() ? "--checkpoint" : !preview.empty() ? "--preview"
+    : last_frame >= 0 ? "--frames" : daemon_socket ? "--daemon" : submit_socket ? "--submit"
+    : worker_list ? "--workers" : NULL;
+  if ((denoise || features) && mode)
+  {
+    cerr << (denoise ? "--denoise" : "--features") << " cannot be combined with " << mode << "\n";
+    return 1;
+  }
+  /// Remote renders use the daemon's own settings for these, the job line does not carry them.
+  const char *local_only = bvh_default != BVH_SAH ? "--bvh" : bvh_quantize ? "--bvh-quantize"
+    : accel_override >= 0 ? "--accel" : sort_rays ? "--sort-rays" : NULL;
+  if (local_only && (submit_socket || worker_list))
+  {
+    cerr << local_only << " cannot be combined with " << (submit_socket ? "--submit" : "--workers")
+         << ", start the daemons with it instead\n";
+    return 1;
+  }
+  if (!view.empty())
+  {
+    return view_preview(view);
   }
-}
-
-/// @brief Generate heap allocated pixel map given hitable list and frame ctx
-/// @param world List of objects to populate vector space.
-/// @param frame frame context
-vec3 **generate_image(
-  hit_list *world,
-  frame_ctx &frame)
-{
-  int nX = frame.nX;
-  int nY = frame.nY;
 
-  /// Allocate image column buffer.
-  vec3 ** image = (vec3 **) malloc(nX);
-  /// memset to track memory
-  memset(image, 0xff, nX);
-  for (int i = 0; i < nX; i ++)
-  {
-    /// Allocate image row buffer.
-    image[i] = (vec3 *) malloc(sizeof(vec3) * nY);
-    for (int j = 0; j < nY; j ++)
+  if (last_frame >= 0)
+  {
+    /// Keys start from the view given by the other options.
+    view_track camera;
+    object_keys objects;
+    std::string err;
+    for (size_t k = 0; k < keys.size(); k++)
     {
-      /// Sample light rays with slight variance
-      /// Generate light ray from camera to frame position.
-      vec3 pixel(0,0,0);
-      for (int s = 0; s < frame.nS; s++)
+      if (!parse_key(keys[k], job, camera, objects, err))
       {
-        float u = (float(i) + drand48()) / float(nX);
-        float v = (float(j) + drand48()) / float(nY);
-        ray light = frame.cam.get_ray(u,v);
-        /// Send light ray into world, generate pixel value.
-        pixel += color(light, world, 0);
+        cerr << "Bad --key: " << err << "\n";
+        return 1;
       }
-      pixel /= frame.nS;
-      /// Gamma correct pixel value by taking the square root.
-      pixel = pixel.sqrt3();
-      
-      /// Assign pixel value to image matrix.
-      ASSERT(WITHIN(0,pixel.r(),1), "Pixel " << pixel << " out of bounds!");
-      ASSERT(WITHIN(0,pixel.r(),1), "Pixel " << pixel << " out of bounds!");
-      ASSERT(WITHIN(0,pixel.g(),1), "Pixel " << pixel << " out of bounds!");
-      ASSERT(WITHIN(0,pixel.b(),1), "Pixel " << pixel << " out of bounds!");
-      image[i][j] = pixel;
     }
+    setup_camera(job.frame);
+    return render_animation(job, first_frame, last_frame, camera, objects);
   }
-  return image;
-}
-
-/// @brief Initialize frame context with default values
-/// @param Frame ctx reference
-void initialize_frame(frame_ctx &frame)
-{
-  /// Define nX and nY by applying resolution to the aspect ratio.
-  frame.nY = IMG_RES;
-  frame.nX = IMG_RES * WIDESCREEN;
-  frame.nS = IMG_SAMPLES;
-  /// Define lookfrom, lookat, vup to position and rotate camera.
-  vec3 lookfrom(-2,2,1);
-  vec3 lookat(0,0,-1);
-  vec3 vup (1,1,0);
-  frame.cam = camera(
-    lookfrom,
-    lookat,
-    vup,
-    90, 
-    WIDESCREEN);
-  return;
-}
-
-/// @brief Generate world
-///
-/// Generate a list of hitable objects to display within frame.
-/// @param frame Frame context for frame limits. 
-hit_list *generate_world(const frame_ctx &frame)
-{
-  hit_list *world = new hit_list();
-
-  /// TODO: Add more objects to hit list. 
-  vec3 center = vec3(0,0,-2);
-  float radius = 0.8;
-  // material * matte_green = new lambertian(GREEN);
-  // material * matte_red = new lambertian(red);
-  /// Add matte green "planet" sphere below frame.
-  world->push(
-    new sphere(
-      vec3(0, -(100 + radius), -1), 
-      100,
-      new lambertian(GREEN)
-    ));
-  /// Add matte red sphere front and center
-  world->push(
-    (hitable *) new sphere(
-      center, 
-      radius,
-      new lambertian(RED)
-    ));
-  /// Add metal blue sphere to the left
-  world->push(
-    (hitable *) new sphere(
-      center - vec3(2 * radius,0,0), 
-      radius,
-      new metal(SKYBLUE)
-    ));
-  /// Add glass sphere to the right
-  world->push(
-    (hitable *) new sphere(
-      center + vec3(2 * radius,0,0), 
-      radius,
-      new dielectric(DIAMOND_IDX)
-    ));
-  
-
-  return world;
-}
-
-/// @brief Destroy heap allocated image buffer. 
-void destroy_image(vec3 **image, const frame_ctx &frame)
-{
-  int nX = frame.nX;
-  vec3 *row;
-  for (int i = 0; i < nX; i ++)
+  if (bench)
   {
-    row = image[i];
-    free(row);
-    row = NULL;
+    setup_camera(job.frame);
+    return run_benchmarks(job.frame);
   }
-  free(image);
-}
-
-/// @brief Write image buffer to .ppm file
-/// @param filename if non-null, writes to "file.ppm"
-/// @param image pixel matrix
-/// @param frame frame context
-int write_ppm(char * filename, vec3 **image, const frame_ctx &frame)
-{
-  ofstream os;
-  char default_filename[] = "file.ppm";
-  if (!filename)
+  if (daemon_socket)
   {
-    filename = default_filename;
+    render_server server(daemon_socket, out_dir);
+    return server.run();
   }
-  os.open(filename);
-
-  int ir, ig, ib;
-  os << "P3\n" << frame.nX << " " << frame.nY << " " << "\n255\n";
-  for (int j = frame.nY-1; j >= 0; j--)
+  if (submit_socket)
+  {
+    return submit_job(submit_socket, job);
+  }
+  if (worker_list)
   {
-    for (int i = 0; i < frame.nX; i++)
+    /// Scene is loaded by the workers, only the framebuffer lives here.
+    tile_coordinator coordinator(job, split_addrs(worker_list), tile_size);
+    vec3 **image = allocate_image(job.frame);
+    bool ok = coordinator.render(image);
+    if (ok)
     {
-      vec3 pixel = image[i][j];
-      ir = int(255.99 * pixel.r());
-      ig = int(255.99 * pixel.g());
-      ib = int(255.99 * pixel.b());
-      os << ir << " " << ig << " " << ib << "\n";
+      write_image(job.out.c_str(), image, job.frame);
     }
-  }  
-  return 0;
-}
+    destroy_image(image, job.frame);
+    return ok ? 0 : 1;
+  }
 
-int main(int c, char **argv) 
-{
-  frame_ctx frame;
-  /// Initialize frame TODO: Allow for parameter to change frame options
-  initialize_frame(frame);
+  frame_ctx &frame = job.frame;
+  /// Initialize frame from the parsed options
+  setup_camera(frame);
   /// Generate world of hitable objects
-  hit_list *world = generate_world(frame);
+  scene *scn = build_scene(job.scene.c_str(), frame, job.texture);
+  if (!scn)
+  {
+    cerr << "Unknown scene " << job.scene << "\n";
+    return 1;
+  }
+  std::string err;
+  if (!job.env.empty() && !scn->load_environment(job.env, err))
+  {
+    cerr << err << "\n";
+    delete scn;
+    return 1;
+  }
+  if (stream)
+  {
+    /// Rows go straight to disk, the full image never exists in memory.
+    scanline_writer *writer = make_scanline_writer(job.out);
+    bool ok = writer->begin(job.out.c_str(), frame.nX, frame.nY)
+      && render_streaming(scn, frame, *writer, band_rows)
+      && writer->finish();
+    delete writer;
+    report_scene(scn);
+    delete scn;
+    if (!ok)
+    {
+      cerr << "Could not write " << job.out << "\n";
+    }
+    return ok ? 0 : 1;
+  }
+  if (!checkpoint.empty() || !preview.empty())
+  {
+    /// Progressive render that survives being killed.
+    accum_buffer accum(frame, checkpoint_scene_id(job.scene, job.env, job.texture));
+    if (resume && !accum.load(checkpoint, err))
+    {
+      cerr << "Cannot resume: " << err << "\n";
+      delete scn;
+      return 1;
+    }
+    /// Viewers watch the passes converge through shared memory.
+    preview_writer live;
+    if (!preview.empty())
+    {
+      if (!live.open(preview, frame, err))
+      {
+        cerr << err << "\n";
+        delete scn;
+        return 1;
+      }
+      live.publish(accum, accum.min_count());
+    }
+    install_stop_handlers();
+    /// Snapshots are encoded and written while the next passes render.
+    async_writer writer;
+    bool done = render_progressive(scn, frame, accum, checkpoint, checkpoint_interval,
+      [&](uint32_t spp) {
+        live.publish(accum, spp);
+        if (snapshot && spp % snapshot == 0 && spp < frame.nS)
+        {
+          writer.submit(job.out, accum.snapshot());
+        }
+      });
+    if (done)
+    {
+      writer.submit(job.out, accum.snapshot());
+      if (!checkpoint.empty())
+      {
+        remove(checkpoint.c_str());
+      }
+    }
+    live.close();
+    int failures = writer.close();
+    report_scene(scn);
+    delete scn;
+    return !done ? 2 : failures ? 1 : 0;
+  }
   /// Generate 2-D pixel matrix of frame
-  vec3 ** image = generate_image(world, frame);
-  /// Write generated image to ppm file TODO: support other file types.
-  write_ppm(NULL, image, frame);
+  vec3 ** image = generate_image(scn, frame);
+  if (denoise || features)
+  {
+    feature_buffers aux = render_features(scn, frame);
+    if (features && write_features(job.out, aux) != 0)
+    {
+      cerr << "Could not write the feature buffers of " << job.out << "\n";
+    }
+    if (denoise)
+    {
+      denoise_image(image, aux);
+    }
+  }
+  /// Write generated image, format chosen by the output extension.
+  write_image(job.out.c_str(), image, frame);
+  report_scene(scn);
   /// Destroy objects, free memory
-  delete world;
+  delete scn;
   destroy_image(image, frame);
 
   return 0;
-}
\ No newline at end of file
+}
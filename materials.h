@@ -4,6 +4,7 @@
 #include "ray.h"
 #include "util.h"
 #include "hitable.h"
+#include "texture.h"
 
 /// Material Class
 /// Material children will expose a "scatter function", which will tell the caller
@@ -13,24 +14,48 @@ class material
   public:
     virtual ~material() {}
     virtual bool scatter(const ray &r_in, hit_record &rec, vec3 &attenuation, ray &scatter) const = 0;
+    /// Radiance emitted by the surface, black unless the material is a light.
+    virtual vec3 emitted() const { return BLACK; }
+    /// True for materials whose lighting can be sampled directly (see eval).
+    virtual bool is_diffuse() const { return false; }
+    /// BRDF times cosine for light arriving from unit direction wi.
+    virtual vec3 eval(const hit_record &rec, const vec3 &wi) const { return BLACK; }
+    /// Solid angle density with which scatter picks unit direction wi.
+    virtual float pdf(const hit_record &rec, const vec3 &wi) const { return 0; }
+    /// Surface color at a finalized hit, the albedo feature of the denoiser.
+    virtual vec3 reflectance(const hit_record &rec) const { return WHITE; }
 };
 
 class lambertian: public material
 {
   public:
-    virtual ~lambertian() {}
-    lambertian(const vec3 &ab): albedo(ab) {} 
+    virtual ~lambertian() { delete albedo; }
+    lambertian(const vec3 &ab): albedo(new constant_texture(ab)) {}
+    /// Takes ownership of the heap allocated texture.
+    lambertian(texture *tex): albedo(tex) {}
     virtual bool scatter(const ray &r_in, hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
-      /// scatter the incoming ray randonmly using a unit sphere tangent to the hitpoint.
-      vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-      scattered = ray(rec.p, target - rec.p);
-      attenuation = albedo;
+      /// scatter the incoming ray with a cosine weighted direction around the normal.
+      float u1 = random_float();
+      float u2 = random_float();
+      scattered = ray(rec.p, sample_cosine_hemisphere(rec.normal, u1, u2));
+      attenuation = albedo->value(rec.u, rec.v, rec.duv);
       return true;
 
     }
+    virtual bool is_diffuse() const { return true; }
+    virtual vec3 reflectance(const hit_record &rec) const { return albedo->value(rec.u, rec.v, rec.duv); }
+    virtual vec3 eval(const hit_record &rec, const vec3 &wi) const
+    {
+      return albedo->value(rec.u, rec.v, rec.duv) * (fmaxf(0, dot(rec.normal, wi)) / float(M_PI));
+    }
+    virtual float pdf(const hit_record &rec, const vec3 &wi) const
+    {
+      /// scatter samples the cosine weighted hemisphere.
+      return fmaxf(0, dot(rec.normal, wi)) / float(M_PI);
+    }
   private:
-    vec3 albedo;
+    texture *albedo;
 };
 
 class metal: public material
@@ -91,7 +116,7 @@ class dielectric : public material
         reflect_prob = 1.0;
       }
 
-      if (drand48() < reflect_prob)
+      if (random_float() < reflect_prob)
       {
         scattered = ray(rec.p, reflected);
         // return true;
@@ -106,5 +131,21 @@ class dielectric : public material
     float ref_idx; /// Refractive index
 };
 
+/// Emissive material: an area light radiating the same radiance everywhere.
+class diffuse_light : public material
+{
+  public:
+    virtual ~diffuse_light() {}
+    diffuse_light(const vec3 &radiance): emit(radiance) {}
+    virtual bool scatter(const ray &r_in, hit_record &rec, vec3 &attenuation, ray &scattered) const
+    {
+      /// Lights absorb everything that hits them.
+      return false;
+    }
+    virtual vec3 emitted() const { return emit; }
+  private:
+    vec3 emit; /// Emitted radiance
+};
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,226 @@
+#ifndef NETH
+#define NETH
+
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+
+#define LINE_MAX_BYTES 65536 /// Longest text line accepted from a peer
+
+/// @brief Bind and listen on a Unix domain socket, replacing a stale one.
+/// @param path filesystem path of the socket
+/// @return listening descriptor, or -1 on error.
+int listen_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// @brief Connect to a Unix domain socket.
+/// @return connected descriptor, or -1 on error.
+int connect_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// @brief Split "host:port" into its parts.
+/// @return true iff addr names a TCP endpoint rather than a socket path.
+bool split_tcp_addr(const char *addr, std::string &host, std::string &port)
+{
+  const char *colon = strrchr(addr, ':');
+  if (!colon || strchr(addr, '/'))
+  {
+    return false;
+  }
+  host = std::string(addr, colon - addr);
+  port = colon + 1;
+  return !port.empty();
+}
+
+/// @brief Open a TCP socket for "host:port", listening or connected.
+/// @return descriptor, or -1 on error.
+int open_tcp(const std::string &host, const std::string &port, bool listening)
+{
+  struct addrinfo hints, *res, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res) != 0)
+  {
+    return -1;
+  }
+  int fd = -1;
+  for (ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+    {
+      continue;
+    }
+    int one = 1;
+    if (listening)
+    {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0)
+      {
+        break;
+      }
+    } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+    {
+      /// Requests are small lines answered by bulk data, don't delay them.
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+/// @brief Listen on "host:port", ":port" or a Unix socket path.
+/// ":port" listens on loopback only; name a host, or 0.0.0.0 for every
+/// interface, to accept other machines.
+int listen_addr(const char *addr)
+{
+  std::string host, port;
+  if (split_tcp_addr(addr, host, port))
+  {
+    return open_tcp(host.empty() ? "localhost" : host, port, true);
+  }
+  return listen_unix(addr);
+}
+
+/// @brief Connect to "host:port" or a Unix socket path.
+int connect_addr(const char *addr)
+{
+  std::string host, port;
+  if (split_tcp_addr(addr, host, port))
+  {
+    return open_tcp(host.empty() ? "localhost" : host, port, false);
+  }
+  return connect_unix(addr);
+}
+
+/// @brief Write all len bytes to a socket.
+/// @return true iff every byte was sent.
+bool send_all(int fd, const void *data, size_t len)
+{
+  const char *p = (const char *) data;
+  while (len > 0)
+  {
+    /// MSG_NOSIGNAL: a vanished peer is an error, not a SIGPIPE.
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/// @brief Read exactly len bytes from a socket.
+/// @return true iff every byte was received.
+bool recv_all(int fd, void *data, size_t len)
+{
+  char *p = (char *) data;
+  while (len > 0)
+  {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/// @brief Send a newline terminated text line.
+bool send_line(int fd, const std::string &line)
+{
+  std::string msg = line + "\n";
+  return send_all(fd, msg.data(), msg.size());
+}
+
+/// @brief Read one line, without its trailing newline.
+/// @param too_long if given, set when the line exceeded LINE_MAX_BYTES
+/// @return false on end of stream, error or a line that is too long.
+bool recv_line(int fd, std::string &line, bool *too_long = NULL)
+{
+  line.clear();
+  if (too_long)
+  {
+    *too_long = false;
+  }
+  char c;
+  for (;;)
+  {
+    ssize_t n = recv(fd, &c, 1, 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    if (c == '\n')
+    {
+      return true;
+    }
+    if (line.size() == LINE_MAX_BYTES)
+    {
+      if (too_long)
+      {
+        *too_long = true;
+      }
+      return false;
+    }
+    line += c;
+  }
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef OUTPUTH
+#define OUTPUTH
+
+#include <stdio.h>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <emmintrin.h>
+#include "vec3.h"
+#include "util.h"
+#include "threads.h"
+#include "stb_image_write.h"
+
+using namespace std;
+
+#define WRITER_QUEUE_DEFAULT 2 /// Frames the async writer buffers before blocking
+#define QUANTIZE_PERIOD 48     /// Floats after which the dither offsets of a row repeat
+
+/// Ordered dithering of 8-bit output, see rgb8_quantizer.
+static bool dither_output = false;
+
+/// Linear RGB image owned independently of the renderer, row-major with the
+/// top row first (the order every file format stores it in).
+typedef struct image_buffer
+{
+  int nX, nY;
+  std::vector<float> rgb;
+  image_buffer(): nX(0), nY(0) {}
+  image_buffer(int w, int h): nX(w), nY(h), rgb(3 * w * h) {}
+  /// @brief Store pixel (i, j), j counted from the bottom like the renderer.
+  inline void set(int i, int j, const vec3 &c)
+  {
+    float *p = &rgb[3 * ((nY - 1 - j) * nX + i)];
+    p[0] = c.r(); p[1] = c.g(); p[2] = c.b();
+  }
+} image_buffer;
+
+/// @brief Copy a pixel matrix into an image buffer.
+image_buffer capture_image(vec3 **image, const frame_ctx &frame)
+{
+  image_buffer img(frame.nX, frame.nY);
+  for (size_t j = 0; j < frame.nY; j++)
+  {
+    for (size_t i = 0; i < frame.nX; i++)
+    {
+      img.set(i, j, image[i][j]);
+    }
+  }
+  return img;
+}
+
+/// @brief Gamma correct (gamma 2) and quantize one linear channel to 8 bits.
+/// NaN and negative values give 0, values too large for 8 bits give 255.
+inline int quantize(float c)
+{
+  if (!(c > 0))
+  {
+    return 0;
+  }
+  /// Clamped in double: converting an out of range double to int is undefined.
+  double v = 255.99 * sqrt(c);
+  return v < 255 ? int(v) : 255;
+}
+
+/// 8-bit quantizer class
+/// Turns rows of interleaved linear RGB floats into RGB8, gamma 2, four
+/// channels at a time with SSE2. Without dithering every byte, including
+/// those of NaN, infinite and negative channels, equals quantize() of the
+/// channel (test_quantize.cc checks this). With dithering a 4x4 Bayer threshold is added
+/// before truncation, which trades banding in smooth gradients for a fine
+/// fixed pattern.
+class rgb8_quantizer
+{
+  public:
+    rgb8_quantizer(bool dither = dither_output)
+    {
+      static const int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+      scale = dither ? 255 : 255.99;
+      for (int y = 0; y < 4; y++)
+      {
+        for (int k = 0; k < QUANTIZE_PERIOD; k++)
+        {
+          offset[y][k] = dither ? (bayer[y][k / 3 % 4] + 0.5) / 16 : 0;
+        }
+      }
+    }
+
+    /// @brief Quantize n floats (n / 3 pixels) of row y.
+    /// @param out (OUT) n bytes
+    void row(const float *rgb, size_t n, int y, uint8_t *out) const
+    {
+      const double *dither = offset[y & 3];
+      size_t k = 0;
+      for (; k + 16 <= n; k += 16)
+      {
+        __m128i q[4];
+        for (int v = 0; v < 4; v++)
+        {
+          q[v] = quantize4(rgb + k + 4 * v, dither + (k + 4 * v) % QUANTIZE_PERIOD);
+        }
+        __m128i words = _mm_packs_epi32(q[0], q[1]);
+        _mm_storeu_si128((__m128i *) (out + k), _mm_packus_epi16(words, _mm_packs_epi32(q[2], q[3])));
+      }
+      for (; k < n; k++)
+      {
+        /// Same clamping as quantize4: NaN is black, the rest clamped before the int conversion.
+        float g = rgb[k] > 0 ? sqrt(rgb[k]) : 0.0f;
+        double c = scale * g + dither[k % QUANTIZE_PERIOD];
+        out[k] = c < 255 ? int(c) : 255;
+      }
+    }
+
+  private:
+    /// @brief Four channels to four ints in [0, 255]. The square root is
+    /// taken in float and the scaling in double, matching quantize().
+    inline __m128i quantize4(const float *rgb, const double *dither) const
+    {
+      /// max returns its second operand for NaN, so NaN becomes black.
+      __m128 g = _mm_sqrt_ps(_mm_max_ps(_mm_loadu_ps(rgb), _mm_setzero_ps()));
+      __m128d s = _mm_set1_pd(scale), top = _mm_set1_pd(255);
+      __m128d lo = _mm_add_pd(_mm_mul_pd(_mm_cvtps_pd(g), s), _mm_loadu_pd(dither));
+      __m128d hi = _mm_add_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(g, g)), s), _mm_loadu_pd(dither + 2));
+      return _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_min_pd(lo, top)), _mm_cvttpd_epi32(_mm_min_pd(hi, top)));
+    }
+
+    double scale;
+    double offset[4][QUANTIZE_PERIOD];  /* Dither offset of each float, by row modulo 4. */
+};
+
+/// @brief Quantize a whole image to RGB8, rows in parallel.
+std::vector<uint8_t> quantize_image(const image_buffer &img)
+{
+  std::vector<uint8_t> rgb8(img.rgb.size());
+  rgb8_quantizer q;
+  size_t stride = 3 * size_t(img.nX);
+  task_group group;
+  group.add(img.nY);
+  for (int j = 0; j < img.nY; j++)
+  {
+    shared_pool().submit([&, j] {
+      q.row(&img.rgb[j * stride], stride, j, &rgb8[j * stride]);
+      group.done();
+    });
+  }
+  group.wait();
+  return rgb8;
+}
+
+/// Formats RGB8 pixels as the text body of a P3 .ppm, one pixel per line,
+/// from a table of the 256 decimal strings rather than per value. Shared by
+/// write_ppm and the streaming .ppm writer.
+class ppm_formatter
+{
+  public:
+    ppm_formatter()
+    {
+      for (int v = 0; v < 256; v++)
+      {
+        snprintf(digits[v], sizeof(digits[v]), "%d", v);
+      }
+    }
+
+    /// @brief Append the lines of n pixels (3 * n bytes) to text.
+    void append(const uint8_t *rgb8, size_t n, std::string &text) const
+    {
+      for (size_t k = 0; k < 3 * n; k += 3)
+      {
+        text += digits[rgb8[k]];
+        text += ' ';
+        text += digits[rgb8[k + 1]];
+        text += ' ';
+        text += digits[rgb8[k + 2]];
+        text += '\n';
+      }
+    }
+
+  private:
+    char digits[256][4];
+};
+
+/// @brief Write image buffer to .ppm file
+/// @param filename output path
+/// @param img linear image
+/// @return 0 on success, -1 if the file could not be written.
+int write_ppm(const char *filename, const image_buffer &img)
+{
+  FILE *f = fopen(filename, "w");
+  if (!f)
+  {
+    return -1;
+  }
+  fprintf(f, "P3\n%d %d \n255\n", img.nX, img.nY);
+  std::vector<uint8_t> rgb8 = quantize_image(img);
+  ppm_formatter format;
+  std::string text;
+  text.reserve(65536 + 12 * size_t(img.nX));
+  size_t stride = 3 * size_t(img.nX);
+  for (int j = 0; j < img.nY; j++)
+  {
+    format.append(&rgb8[j * stride], img.nX, text);
+    if (text.size() > 65536 || j + 1 == img.nY)
+    {
+      fwrite(text.data(), 1, text.size(), f);
+      text.clear();
+    }
+  }
+  bool ok = !ferror(f);
+  return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+/// @brief Write image buffer to an 8-bit .png file.
+int write_png(const char *filename, const image_buffer &img)
+{
+  std::vector<uint8_t> rgb8 = quantize_image(img);
+  return stbi_write_png(filename, img.nX, img.nY, 3, rgb8.data(), 3 * img.nX) ? 0 : -1;
+}
+
+/// @brief Write image buffer to a Radiance .hdr file, keeping linear values.
+int write_hdr(const char *filename, const image_buffer &img)
+{
+  return stbi_write_hdr(filename, img.nX, img.nY, 3, img.rgb.data()) ? 0 : -1;
+}
+
+/// @brief Encode an image in the format named by the file extension
+/// (.png, .hdr, anything else is written as .ppm).
+/// @return 0 on success, -1 on error.
+int write_image(const std::string &filename, const image_buffer &img)
+{
+  size_t dot = filename.rfind('.');
+  std::string ext = dot == std::string::npos ? "" : filename.substr(dot);
+  if (ext == ".png")
+  {
+    return write_png(filename.c_str(), img);
+  }
+  if (ext == ".hdr")
+  {
+    return write_hdr(filename.c_str(), img);
+  }
+  return write_ppm(filename.c_str(), img);
+}
+
+/// @brief Write a pixel matrix, format chosen by the file extension.
+/// @param filename if non-null, writes to "file.ppm"
+/// @param image pixel matrix
+/// @param frame frame context
+int write_image(const char *filename, vec3 **image, const frame_ctx &frame)
+{
+  return write_image(filename ? filename : "file.ppm", capture_image(image, frame));
+}
+
+/// Asynchronous writer class
+/// Encodes and writes images on a background thread so the render loop can
+/// continue with the next frame or pass. The queue is bounded: submit()
+/// blocks while it is full, which throttles rendering to the disk speed
+/// instead of piling up frames in memory.
+class async_writer
+{
+  public:
+    async_writer(size_t queue_size = WRITER_QUEUE_DEFAULT):
+      capacity(queue_size), closing(false), failures(0), waits(0)
+    {
+      worker = std::thread(&async_writer::work, this);
+    }
+    ~async_writer() { close(); }
+
+    /// @brief Queue an image for writing, blocking while the queue is full.
+    void submit(const std::string &filename, image_buffer &&img)
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (queue.size() >= capacity)
+      {
+        waits++;
+        not_full.wait(lock, [this] { return queue.size() < capacity; });
+      }
+      queue.push_back(pending_write{filename, std::move(img)});
+      not_empty.notify_one();
+    }
+
+    /// @brief Finish every queued write and stop the writer thread.
+    /// @return number of images that could not be written.
+    int close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        closing = true;
+      }
+      not_empty.notify_one();
+      if (worker.joinable())
+      {
+        worker.join();
+      }
+      return failures;
+    }
+
+    /// @brief Times submit() blocked on a full queue.
+    inline size_t stalls() const { return waits; }
+
+  private:
+    typedef struct pending_write
+    {
+      std::string filename;
+      image_buffer img;
+    } pending_write;
+
+    void work()
+    {
+      for (;;)
+      {
+        pending_write w;
+        {
+          std::unique_lock<std::mutex> lock(mtx);
+          not_empty.wait(lock, [this] { return closing || !queue.empty(); });
+          if (queue.empty())
+          {
+            return;
+          }
+          w = std::move(queue.front());
+          queue.pop_front();
+        }
+        not_full.notify_one();
+        if (write_image(w.filename, w.img) != 0)
+        {
+          cerr << "Could not write " << w.filename << "\n";
+          failures++;
+        }
+      }
+    }
+
+    size_t capacity;                    /* Maximum queued images. */
+    std::deque<pending_write> queue;
+    std::mutex mtx;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::thread worker;
+    bool closing;                       /* No more submissions, drain and exit. */
+    int failures;                       /* Writes that failed, read after join. */
+    size_t waits;                       /* Back-pressure events. */
+};
+
+#endif
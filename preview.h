@@ -0,0 +1,311 @@
+#ifndef PREVIEWH
+#define PREVIEWH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include "vec3.h"
+#include "util.h"
+#include "film.h"
+#include "output.h"
+
+#define PREVIEW_MAGIC "RTPV"
+#define PREVIEW_VERSION 1
+#define PREVIEW_POLL_MS 100 /// Viewer refresh interval
+
+/// Header of a preview segment, followed by two nX * nY buffers of linear
+/// mean colors (3 floats per pixel, rows top to bottom).
+///
+/// The renderer alternates between the buffers and publishes each under a
+/// sequence lock: seq[b] is odd while buffer b is being written and bumped
+/// to the next even value once it is complete, then front is pointed at it.
+/// Readers map the segment, read buffer front in place and keep the result
+/// only if seq[front] is even and unchanged afterwards. The renderer never
+/// waits for readers; with two buffers a reader has a whole pass to finish
+/// before its buffer is overwritten.
+typedef struct preview_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t nX, nY, nS;
+  std::atomic<uint32_t> front;   /// Buffer published last
+  std::atomic<uint32_t> done;    /// Set once the render stopped
+  std::atomic<uint32_t> spp[2];  /// Samples per pixel in each buffer
+  std::atomic<uint64_t> seq[2];  /// Sequence lock of each buffer
+} preview_header;
+
+/// Pixel data starts on its own cache line.
+#define PREVIEW_DATA_OFFSET ((sizeof(preview_header) + 63) & ~size_t(63))
+
+/// @brief Segment name as shm_open wants it, with a leading slash.
+inline std::string preview_shm_name(const std::string &name)
+{
+  return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+/// Preview writer class
+/// Creates the shared memory segment of a render and publishes the
+/// accumulation buffer into it after every pass.
+class preview_writer
+{
+  public:
+    preview_writer(): h(NULL), size(0) {}
+    ~preview_writer()
+    {
+      close();
+    }
+
+    /// @brief Create (or replace) segment name for frame.
+    /// @param err (OUT) reason for failure
+    bool open(const std::string &name, const frame_ctx &frame, std::string &err)
+    {
+      path = preview_shm_name(name);
+      /// Start from a fresh segment, so stale readers never see a resize.
+      shm_unlink(path.c_str());
+      int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if (fd < 0)
+      {
+        err = "cannot create shared memory " + path + ": " + strerror(errno);
+        return false;
+      }
+      size = PREVIEW_DATA_OFFSET + 2 * buffer_bytes(frame.nX, frame.nY);
+      void *mem = ftruncate(fd, size) == 0 ?
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+      ::close(fd);
+      if (mem == MAP_FAILED)
+      {
+        err = "cannot map shared memory " + path + ": " + strerror(errno);
+        shm_unlink(path.c_str());
+        return false;
+      }
+      /// ftruncate zero fills, so both buffers start black with even sequences.
+      h = new (mem) preview_header;
+      memcpy(h->magic, PREVIEW_MAGIC, 4);
+      h->version = PREVIEW_VERSION;
+      h->nX = frame.nX;
+      h->nY = frame.nY;
+      h->nS = frame.nS;
+      h->front.store(0, std::memory_order_relaxed);
+      h->done.store(0, std::memory_order_relaxed);
+      for (int b = 0; b < 2; b++)
+      {
+        h->spp[b].store(0, std::memory_order_relaxed);
+        h->seq[b].store(0, std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_release);
+      return true;
+    }
+
+    /// @brief Publish the current means of accum, spp samples per pixel,
+    /// into the buffer readers are not looking at.
+    void publish(const accum_buffer &accum, uint32_t spp)
+    {
+      if (!h)
+      {
+        return;
+      }
+      uint32_t b = 1 - h->front.load(std::memory_order_relaxed);
+      uint64_t seq = h->seq[b].load(std::memory_order_relaxed);
+      h->seq[b].store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      float *px = buffer(b);
+      for (uint32_t r = 0; r < h->nY; r++)
+      {
+        for (uint32_t i = 0; i < h->nX; i++)
+        {
+          vec3 c = accum.mean(i, h->nY - 1 - r);
+          float *p = px + 3 * (size_t(r) * h->nX + i);
+          p[0] = c.r();
+          p[1] = c.g();
+          p[2] = c.b();
+        }
+      }
+      h->spp[b].store(spp, std::memory_order_relaxed);
+      h->seq[b].store(seq + 2, std::memory_order_release);
+      h->front.store(b, std::memory_order_release);
+    }
+
+    /// @brief Tell readers the render stopped and remove the segment name.
+    /// Mapped readers keep their view of the last buffer.
+    void close()
+    {
+      if (!h)
+      {
+        return;
+      }
+      h->done.store(1, std::memory_order_release);
+      munmap(h, size);
+      shm_unlink(path.c_str());
+      h = NULL;
+    }
+
+    static inline size_t buffer_bytes(size_t nX, size_t nY) { return 3 * sizeof(float) * nX * nY; }
+
+  private:
+    inline float *buffer(int b) const
+    {
+      return (float *) ((char *) h + PREVIEW_DATA_OFFSET + b * buffer_bytes(h->nX, h->nY));
+    }
+
+    preview_header *h;
+    size_t size;
+    std::string path;
+};
+
+/// Preview reader class
+/// Maps a preview segment read-only and hands out consistent views of the
+/// latest published buffer.
+class preview_reader
+{
+  public:
+    preview_reader(): h(NULL), size(0) {}
+    ~preview_reader()
+    {
+      if (h)
+      {
+        munmap((void *) h, size);
+      }
+    }
+
+    /// @param err (OUT) reason for failure
+    bool open(const std::string &name, std::string &err)
+    {
+      std::string path = preview_shm_name(name);
+      int fd = shm_open(path.c_str(), O_RDONLY, 0);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0)
+      {
+        err = "cannot open shared memory " + path + ": " + strerror(errno);
+        if (fd >= 0)
+        {
+          ::close(fd);
+        }
+        return false;
+      }
+      size = st.st_size;
+      void *mem = size >= PREVIEW_DATA_OFFSET ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+      ::close(fd);
+      if (mem == MAP_FAILED)
+      {
+        err = path + " is not a preview";
+        return false;
+      }
+      h = (const preview_header *) mem;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (memcmp(h->magic, PREVIEW_MAGIC, 4) != 0 || h->version != PREVIEW_VERSION
+          || size < PREVIEW_DATA_OFFSET + 2 * preview_writer::buffer_bytes(h->nX, h->nY))
+      {
+        err = path + " is not a preview";
+        return false;
+      }
+      return true;
+    }
+
+    inline const preview_header &header() const { return *h; }
+
+    /// @brief Call view(pixels, spp) on the latest buffer, in place.
+    ///
+    /// The buffer may change under view; the call is repeated until it
+    /// saw a buffer that stayed unchanged throughout.
+    /// @return sequence number of the buffer viewed
+    template <class F>
+    uint64_t read(F view) const
+    {
+      for (;;)
+      {
+        uint32_t b = h->front.load(std::memory_order_acquire);
+        uint64_t seq = h->seq[b].load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+          continue;
+        }
+        uint32_t spp = h->spp[b].load(std::memory_order_relaxed);
+        view((const float *) ((const char *) h + PREVIEW_DATA_OFFSET
+          + b * preview_writer::buffer_bytes(h->nX, h->nY)), spp);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (h->seq[b].load(std::memory_order_relaxed) == seq)
+        {
+          return seq << 1 | b;
+        }
+      }
+    }
+
+  private:
+    const preview_header *h;
+    size_t size;
+};
+
+/// @brief Show a preview segment in the terminal until its render stops,
+/// two pixels per character cell using 24-bit colors.
+/// @return 0, or 1 if the segment cannot be opened
+int view_preview(const std::string &name)
+{
+  preview_reader reader;
+  std::string err;
+  if (!reader.open(name, err))
+  {
+    fprintf(stderr, "%s\n", err.c_str());
+    return 1;
+  }
+  const preview_header &h = reader.header();
+  int cols = 80;
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+  {
+    cols = ws.ws_col;
+  }
+  cols = std::min<int>(cols, h.nX);
+  float step = float(h.nX) / cols;
+  int lines = std::max(1, int(h.nY / (2 * step)));
+  std::string screen;
+  uint64_t shown = ~uint64_t(0);
+  printf("\x1b[2J");
+  for (;;)
+  {
+    bool last = h.done.load(std::memory_order_acquire);
+    uint32_t spp = 0;
+    uint64_t seq = reader.read([&](const float *px, uint32_t n) {
+      spp = n;
+      screen = "\x1b[H";
+      for (int l = 0; l < lines; l++)
+      {
+        for (int c = 0; c < cols; c++)
+        {
+          /// Upper half block: foreground is the top pixel, background the bottom.
+          const float *top = px + 3 * (size_t(2 * l * step) * h.nX + size_t(c * step));
+          const float *bottom = px + 3 * (size_t((2 * l + 1) * step) * h.nX + size_t(c * step));
+          char cell[96];
+          snprintf(cell, sizeof(cell), "\x1b[38;2;%d;%d;%dm\x1b[48;2;%d;%d;%dm\xe2\x96\x80",
+            quantize(top[0]), quantize(top[1]), quantize(top[2]),
+            quantize(bottom[0]), quantize(bottom[1]), quantize(bottom[2]));
+          screen += cell;
+        }
+        screen += "\x1b[0m\n";
+      }
+    });
+    if (seq != shown)
+    {
+      shown = seq;
+      printf("%s%u/%u samples per pixel\x1b[K\n", screen.c_str(), spp, h.nS);
+      fflush(stdout);
+    }
+    if (last)
+    {
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(PREVIEW_POLL_MS));
+  }
+}
+
+#endif
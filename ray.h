@@ -7,14 +7,19 @@
 class ray
 {
   public:
-    ray() {}
-    ray(const vec3 &a, const vec3 &b) {A = a; B = b;}
+    ray(): width(0), spread(0), time(0) {}
+    ray(const vec3 &a, const vec3 &b, float ti = 0): width(0), spread(0), time(ti) {A = a; B = b;}
     vec3 origin() const {return A;}
     vec3 direction() const {return B;}
     vec3 point_at_parameter(float t) const { return A + (t * B);}
+    /// Width of the ray cone at parameter t, used to filter textures.
+    float footprint(float t) const { return width + spread * t; }
 
     vec3 A;
     vec3 B;
+    float width;  /// Cone width at the origin
+    float spread; /// Cone width gained per unit of t
+    float time;   /// When the ray was sent, 0 to 1 from shutter open to close
 };
 
 inline std::istream& operator>>(std::istream &is, ray &r)
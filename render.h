@@ -0,0 +1,484 @@
+#ifndef RENDERH
+#define RENDERH
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "float.h"
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "rng.h"
+#include "sampler.h"
+#include "hitable.h"
+#include "materials.h"
+#include "util.h"
+#include "threads.h"
+#include "arena.h"
+#include "scene.h"
+
+#define DIFFUSE_SPREAD 0.1 /// Ray cone spread after a diffuse bounce, radians
+#define RAY_BATCH 4096     /// Paths traced together by render_row_sorted, at most 65536
+
+/// Progress callback, called with the number of finished rows.
+typedef std::function<void(size_t rows_done)> progress_fn;
+
+/// @brief Light arriving at a diffuse hit directly from the scene's lights.
+///
+/// Next-event estimation: sample one point on one light and trace a shadow
+/// ray towards it. Emission found by the following bounce must then be
+/// skipped, or the lights would be counted twice.
+/// @param scn scene holding the lights
+/// @param rec hit record of the diffuse surface
+/// @param time time of the ray that found the surface
+vec3 direct_light(const scene *scn, const hit_record &rec, float time)
+{
+  float u0 = random_float();
+  float u1 = random_float();
+  float u2 = random_float();
+  light_sample ls;
+  if (!scn->lights.sample(rec.p, u0, u1, u2, ls) || dot(ls.wi, rec.normal) <= 0)
+  {
+    return BLACK;
+  }
+  /// Stop just short of the light, which is part of the world too.
+  if (scn->world->occluded(ray(rec.p, ls.wi, time), 0.0001, ls.dist * 0.999f))
+  {
+    return BLACK;
+  }
+  return ls.radiance * rec.mat->eval(rec, ls.wi) / ls.pdf;
+}
+
+/// @brief Power heuristic weight (beta = 2) of a sample drawn with density
+/// pdf_a, when pdf_b could also have produced it.
+inline float power_heuristic(float pdf_a, float pdf_b)
+{
+  float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+  return a + b > 0 ? a / (a + b) : 0;
+}
+
+/// @brief Environment light arriving at a diffuse hit, importance sampled
+/// from the map and weighted against BSDF sampling (MIS).
+/// @param scn scene holding the environment
+/// @param rec hit record of the diffuse surface
+/// @param time time of the ray that found the surface
+vec3 environment_light(const scene *scn, const hit_record &rec, float time)
+{
+  float u1 = random_float();
+  float u2 = random_float();
+  vec3 wi;
+  float light_pdf;
+  if (!scn->env->sample(u1, u2, wi, light_pdf) || dot(wi, rec.normal) <= 0)
+  {
+    return BLACK;
+  }
+  if (scn->world->occluded(ray(rec.p, wi, time), 0.0001, MAXFLOAT))
+  {
+    return BLACK;
+  }
+  float w = power_heuristic(light_pdf, rec.mat->pdf(rec, wi));
+  return scn->env->radiance(wi) * rec.mat->eval(rec, wi) * (w / light_pdf);
+}
+
+/// State of one light path between bounces.
+typedef struct path_state
+{
+  ray r;              /// Ray to trace next
+  vec3 throughput;    /// Product of the attenuations so far
+  vec3 radiance;      /// Light gathered so far
+  int depth;          /// Bounces so far
+  bool count_emitted; /// False after a diffuse bounce whose lights were sampled directly
+  float bsdf_pdf;     /// Density r was sampled with against the environment map, or 0
+} path_state;
+
+/// @brief Start a path along camera ray r.
+inline void start_path(path_state &p, const ray &r)
+{
+  p.r = r;
+  p.throughput = vec3(1, 1, 1);
+  p.radiance = BLACK;
+  p.depth = 0;
+  p.count_emitted = true;
+  p.bsdf_pdf = 0;
+}
+
+/// @brief Trace one bounce of path p: gather the emission, direct light or
+/// background it finds, and set up the scattered ray.
+/// @param scn scene the path travels through
+/// @return true while the path goes on
+bool trace_step(const scene *scn, path_state &p)
+{
+  const ray &r = p.r;
+  // Initialize hit record.
+  hit_record rec;
+  // Compute hitpoint.
+  bool hit = scn->world->hit(r, 0.0001, MAXFLOAT, rec);
+  if (!hit)
+  {
+    // Background compute.
+    vec3 uv = unit_vector(r.direction());
+    vec3 background;
+    if (scn->env)
+    {
+      /// Diffuse bounces share this direction with environment_light.
+      vec3 env = scn->env->radiance(uv);
+      background = p.bsdf_pdf > 0 ? power_heuristic(p.bsdf_pdf, scn->env->pdf(uv)) * env : env;
+    } else
+    {
+      float t = 0.5 * (uv.y() + 1);
+      /// Evenly blend sky blue and white along the ray direction's y axis.
+      background = scn->sky * ((1 - t) * WHITE + (t) * SKYBLUE);
+    }
+    p.radiance += p.throughput * background;
+    return false;
+  }
+  if (p.count_emitted)
+  {
+    p.radiance += p.throughput * rec.mat->emitted();
+  } else
+  {
+    /// Only the listed lights were sampled at the last bounce; other emitters are found by hitting them.
+    vec3 emit = rec.mat->emitted();
+    if (emit.squared_length() > 0 && !scn->lights.contains(rec.obj))
+    {
+      p.radiance += p.throughput * emit;
+    }
+  }
+  /// Attempt to scatter light ray given depth required.
+  ray scattered;
+  vec3 attenuation;
+  if (p.depth >= 50 || !rec.mat->scatter(r, rec, attenuation, scattered))
+  {
+    /// Max depth was exceeded, or light was absorbed!
+    /// Only the surface's own emission remains.
+    return false;
+  }
+  bool diffuse = rec.mat->is_diffuse();
+  bool sample_lights = diffuse && !scn->lights.empty();
+  vec3 direct = sample_lights ? direct_light(scn, rec, r.time) : BLACK;
+  float pdf = 0;
+  if (diffuse && scn->env)
+  {
+    direct += environment_light(scn, rec, r.time);
+    pdf = rec.mat->pdf(rec, unit_vector(scattered.direction()));
+  }
+  /// Widen the ray cone: diffuse bounces blur it, mirrors keep its spread.
+  scattered.width = r.footprint(rec.t);
+  scattered.spread = diffuse ? DIFFUSE_SPREAD : r.spread * r.direction().length();
+  scattered.spread /= scattered.direction().length();
+  /// Whole paths live at the instant their camera ray was sent.
+  scattered.time = r.time;
+  p.radiance += p.throughput * direct;
+  p.throughput *= attenuation;
+  p.r = scattered;
+  p.depth++;
+  p.count_emitted = !sample_lights;
+  p.bsdf_pdf = pdf;
+  return true;
+}
+
+/// @brief return pixel color by querying world for a given light ray.
+/// @param r incoming light ray
+/// @param scn scene whose objects produce colors when hit by the light ray.
+vec3 color(const ray &r, const scene *scn)
+{
+  path_state p;
+  start_path(p, r);
+  while (trace_step(scn, p))
+  {
+  }
+  return p.radiance;
+}
+
+/// @brief Seed the stream of sample s of pixel (i, j) and generate its
+/// camera ray.
+///
+/// Every sample seeds its own stream from (seed, i, j, s) through the frame's
+/// sampler, so the result only depends on the pixel, never on the thread
+/// rendering it.
+/// @param frame frame context
+/// @param i pixel column
+/// @param j pixel row, counted from the bottom of the frame
+/// @param s sample index
+ray camera_ray(const frame_ctx &frame, int i, int j, int s)
+{
+  /// Sample light rays with slight variance
+  /// Generate light ray from camera to frame position.
+  seed_sample(get_sampler(frame.sampling), frame.nS, frame.seed, i, j, s);
+  float u = (float(i) + random_float()) / float(frame.nX);
+  float v = (float(j) + random_float()) / float(frame.nY);
+  ray light = frame.cam.get_ray(u,v);
+  light.spread = frame.cam.pixel_spread(frame.nY);
+  /// Static renders draw no time, keeping their random streams unchanged.
+  if (frame.shutter > 0)
+  {
+    light.time = random_float();
+  }
+  return light;
+}
+
+/// @brief Trace sample s of pixel (i, j).
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param i pixel column
+/// @param j pixel row, counted from the bottom of the frame
+/// @param s sample index
+vec3 sample_pixel(const scene *scn, const frame_ctx &frame, int i, int j, int s)
+{
+  /// Send light ray into world, generate pixel value.
+  return color(camera_ray(frame, i, j, s), scn);
+}
+
+/// @brief Mean color of a pixel from the sum of its samples.
+inline vec3 resolve_pixel(vec3 sum, const frame_ctx &frame)
+{
+  vec3 pixel = sum / frame.nS;
+  /// Gamma correction is left to the output stage.
+  /// Emitters make radiance unbounded above, only negative values are errors.
+  ASSERT(pixel.r() >= 0, "Pixel " << pixel << " out of bounds!");
+  ASSERT(pixel.g() >= 0, "Pixel " << pixel << " out of bounds!");
+  ASSERT(pixel.b() >= 0, "Pixel " << pixel << " out of bounds!");
+  return pixel;
+}
+
+/// @brief Render the linear mean color of a single pixel.
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param i pixel column
+/// @param j pixel row, counted from the bottom of the frame
+vec3 render_pixel(const scene *scn, const frame_ctx &frame, int i, int j)
+{
+  vec3 pixel(0,0,0);
+  for (size_t s = 0; s < frame.nS; s++)
+  {
+    pixel += sample_pixel(scn, frame, i, j, s);
+  }
+  return resolve_pixel(pixel, frame);
+}
+
+/// Trace secondary rays in batches sorted by direction and origin, see
+/// render_row_sorted. Set from the command line before rendering.
+static bool sort_rays = false;
+
+/// Path of a sorted batch, with its own random stream.
+typedef struct batch_path
+{
+  path_state state;
+  rng_state rng;
+  int pixel;  /// Offset of the pixel within the row span
+} batch_path;
+
+/// @brief Sort key grouping rays by direction octant, then by the position
+/// of their origin along a Z-order curve through origins.
+inline uint32_t ray_sort_key(const ray &r, const aabb &origins)
+{
+  vec3 d = r.direction();
+  uint32_t octant = (d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2;
+  return octant << 29 | origins.morton_code(r.origin()) >> 1;
+}
+
+/// @brief Render pixels x0 to x1 of row j, tracing every sample of the span
+/// one bounce at a time.
+///
+/// Camera rays are coherent already; after the first bounce the surviving
+/// paths are sorted by ray_sort_key before each round, so that consecutive
+/// rays walk similar parts of the acceleration structure. Each path keeps
+/// its own random stream and samples are summed in index order, so pixels
+/// come out exactly as render_pixel computes them.
+/// @param out (OUT) x1 - x0 pixels
+void render_row_sorted(const scene *scn, const frame_ctx &frame, int j, int x0, int x1, vec3 *out)
+{
+  scratch_arena &arena = thread_arena();
+  arena_scope scope(arena);
+  vec3 *sum = arena.alloc<vec3>(x1 - x0, BLACK);
+  size_t total = size_t(x1 - x0) * frame.nS;
+  batch_path *batch = arena.alloc<batch_path>(std::min<size_t>(RAY_BATCH, total));
+  uint64_t *order = arena.alloc<uint64_t>(std::min<size_t>(RAY_BATCH, total));
+  for (size_t first = 0; first < total; first += RAY_BATCH)
+  {
+    size_t n = std::min<size_t>(RAY_BATCH, total - first);
+    size_t live = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+      /// Sample-major within a pixel, as render_pixel draws them.
+      int px = (first + k) / frame.nS;
+      int s = (first + k) % frame.nS;
+      batch[k].pixel = px;
+      start_path(batch[k].state, camera_ray(frame, x0 + px, j, s));
+      batch[k].rng = thread_rng();
+      order[live++] = k;
+    }
+    for (int bounce = 0; live > 0; bounce++)
+    {
+      if (bounce > 0)
+      {
+        aabb origins;
+        for (size_t k = 0; k < live; k++)
+        {
+          origins.extend(batch[order[k] & 0xffff].state.r.origin());
+        }
+        for (size_t k = 0; k < live; k++)
+        {
+          uint64_t index = order[k] & 0xffff;
+          order[k] = uint64_t(ray_sort_key(batch[index].state.r, origins)) << 16 | index;
+        }
+        std::sort(order, order + live);
+      }
+      size_t alive = 0;
+      for (size_t k = 0; k < live; k++)
+      {
+        batch_path &p = batch[order[k] & 0xffff];
+        thread_rng() = p.rng;
+        if (trace_step(scn, p.state))
+        {
+          order[alive++] = order[k];
+        }
+        p.rng = thread_rng();
+      }
+      live = alive;
+    }
+    for (size_t k = 0; k < n; k++)
+    {
+      sum[batch[k].pixel] += batch[k].state.radiance;
+    }
+  }
+  for (int i = x0; i < x1; i++)
+  {
+    out[i - x0] = resolve_pixel(sum[i - x0], frame);
+  }
+}
+
+/// @brief Render pixels x0 to x1 of row j.
+/// @param out (OUT) x1 - x0 pixels
+void render_row(const scene *scn, const frame_ctx &frame, int j, int x0, int x1, vec3 *out)
+{
+  if (sort_rays)
+  {
+    render_row_sorted(scn, frame, j, x0, x1, out);
+    return;
+  }
+  for (int i = x0; i < x1; i++)
+  {
+    out[i - x0] = render_pixel(scn, frame, i, j);
+  }
+}
+
+/// @brief Allocate an uninitialized nX by nY pixel matrix, indexed image[i][j].
+vec3 **allocate_image(const frame_ctx &frame)
+{
+  int nX = frame.nX;
+  /// Allocate image column buffer.
+  vec3 ** image = (vec3 **) malloc(sizeof(vec3 *) * nX);
+  for (int i = 0; i < nX; i ++)
+  {
+    /// Allocate image row buffer.
+    image[i] = (vec3 *) malloc(sizeof(vec3) * frame.nY);
+  }
+  return image;
+}
+
+/// @brief Render every pixel of the frame into image on the shared pool.
+///
+/// Rows are queued as individual tasks, so concurrent renders interleave
+/// according to their priority.
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param image (OUT) pixel matrix from allocate_image
+/// @param priority scheduling priority of this render's rows
+/// @param progress optional callback, invoked from workers after each row
+void render_image(
+  const scene *scn,
+  const frame_ctx &frame,
+  vec3 **image,
+  int priority = 0,
+  progress_fn progress = NULL)
+{
+  task_group group;
+  std::atomic<size_t> rows_done(0);
+  group.add(frame.nY);
+  for (size_t j = 0; j < frame.nY; j++)
+  {
+    shared_pool().submit([&, j] {
+      arena_scope scope;
+      vec3 *row = thread_arena().alloc<vec3>(frame.nX);
+      render_row(scn, frame, j, 0, frame.nX, row);
+      for (size_t i = 0; i < frame.nX; i++)
+      {
+        /// Assign pixel value to image matrix.
+        image[i][j] = row[i];
+      }
+      size_t done = ++rows_done;
+      if (progress)
+      {
+        progress(done);
+      }
+      group.done();
+    }, priority);
+  }
+  group.wait();
+}
+
+/// Rectangle of pixels [x0, x1) x [y0, y1), rows counted from the bottom.
+typedef struct tile_rect
+{
+  int x0, y0;
+  int x1, y1;
+  inline int width() const { return x1 - x0; }
+  inline int height() const { return y1 - y0; }
+} tile_rect;
+
+/// @brief Render one tile of the frame on the shared pool.
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param t tile to render
+/// @param out (OUT) row-major buffer of t.width() * t.height() pixels
+/// @param priority scheduling priority of the tile rows
+void render_tile(
+  const scene *scn,
+  const frame_ctx &frame,
+  const tile_rect &t,
+  vec3 *out,
+  int priority = 0)
+{
+  task_group group;
+  group.add(t.height());
+  for (int j = t.y0; j < t.y1; j++)
+  {
+    shared_pool().submit([&, j] {
+      render_row(scn, frame, j, t.x0, t.x1, out + (j - t.y0) * t.width());
+      group.done();
+    }, priority);
+  }
+  group.wait();
+}
+
+/// @brief Generate heap allocated pixel map given hitable list and frame ctx
+/// @param scn Scene to render.
+/// @param frame frame context
+vec3 **generate_image(
+  const scene *scn,
+  frame_ctx &frame)
+{
+  vec3 **image = allocate_image(frame);
+  render_image(scn, frame, image);
+  return image;
+}
+
+/// @brief Destroy heap allocated image buffer.
+void destroy_image(vec3 **image, const frame_ctx &frame)
+{
+  int nX = frame.nX;
+  vec3 *row;
+  for (int i = 0; i < nX; i ++)
+  {
+    row = image[i];
+    free(row);
+    row = NULL;
+  }
+  free(image);
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef RNGH
+#define RNGH
+
+#include <stdint.h>
+
+/// Sampler class
+/// Supplies the value of one dimension of one sample of a pixel. Samplers
+/// are pure functions of their arguments, so any sample can be recomputed
+/// in isolation (by another thread, process, or after a resume).
+class sampler
+{
+  public:
+    virtual ~sampler() {}
+    /// @param key hash of frame seed and pixel
+    /// @param i pixel column
+    /// @param j pixel row
+    /// @param index sample index within the pixel
+    /// @param count samples per pixel of the render
+    /// @param dim dimension along the path
+    /// @return value in [0, 1)
+    virtual float sample(uint32_t key, int i, int j, uint32_t index, uint32_t count, uint32_t dim) const = 0;
+};
+
+/// Per-sample random number state.
+/// Every camera sample draws from its own stream keyed by the frame seed,
+/// pixel and sample index. A pixel therefore renders identically no matter
+/// which thread (or process) computes it, or in which order.
+typedef struct rng_state
+{
+  uint32_t key;   /// Hash of frame seed and pixel coordinates
+  uint32_t index; /// Sample index within the pixel
+  uint32_t dim;   /// Next dimension to draw from the stream
+  uint32_t count; /// Samples per pixel
+  int i, j;       /// Pixel coordinates
+  const sampler *smp; /// Sampler providing the stream, NULL for plain hashing
+} rng_state;
+
+/// @brief Integer hash with good avalanche (lowbias32).
+inline uint32_t hash_u32(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+/// @brief Map 32 random bits to a float in [0, 1).
+inline float bits_to_float(uint32_t h)
+{
+  /// Keep 24 bits so the result is exactly representable and strictly below 1.
+  return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+/// @brief Uniform hash based value for one dimension of a sample.
+inline float hash_sample(uint32_t key, uint32_t index, uint32_t dim)
+{
+  return bits_to_float(hash_u32(key ^ hash_u32(index + hash_u32(dim))));
+}
+
+/// @brief State of the calling thread's current sample stream.
+inline rng_state &thread_rng()
+{
+  static thread_local rng_state state = {0, 0, 0, 1, 0, 0, NULL};
+  return state;
+}
+
+/// @brief Start the stream for sample s of pixel (i, j).
+/// @param smp sampler to draw from, NULL for independent random values
+/// @param count samples per pixel of the render
+/// @param seed frame seed
+/// @param i pixel column
+/// @param j pixel row
+/// @param s sample index within the pixel
+inline void seed_sample(const sampler *smp, uint32_t count, uint32_t seed, int i, int j, int s)
+{
+  rng_state &state = thread_rng();
+  state.key = hash_u32(seed ^ hash_u32(uint32_t(i) ^ hash_u32(uint32_t(j))));
+  state.index = uint32_t(s);
+  state.dim = 0;
+  state.count = count;
+  state.i = i;
+  state.j = j;
+  state.smp = smp;
+}
+
+/// @brief Next value in [0, 1) of the current sample stream.
+inline float random_float()
+{
+  rng_state &state = thread_rng();
+  uint32_t dim = state.dim++;
+  if (state.smp)
+  {
+    return state.smp->sample(state.key, state.i, state.j, state.index, state.count, dim);
+  }
+  return hash_sample(state.key, state.index, dim);
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "rng.h"
+
+#define SAMPLE_MAX 0x1.fffffep-1f /// Largest float below 1, samplers never return more
+
+/// Sampler choices, selectable per render.
+enum sampler_type
+{
+  SAMPLER_RANDOM = 0,   /// Independent hashed random values (hash_sample)
+  SAMPLER_STRATIFIED,   /// Per-dimension jittered strata across the pixel's samples
+  SAMPLER_SOBOL,        /// Owen scrambled Sobol (0,2)-sequence, padded per dimension pair
+  SAMPLER_BLUENOISE,    /// Sobol shared by all pixels, offset per pixel by a blue-noise mask
+  SAMPLER_COUNT
+};
+
+static const char *sampler_names[SAMPLER_COUNT] = {"random", "stratified", "sobol", "bluenoise"};
+
+/// @brief Reverse the bit order of a 32-bit word.
+inline uint32_t reverse_bits(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/// @brief Hash based Owen scramble (Laine-Karras permutation on reversed bits).
+///
+/// Every bit is flipped depending only on the bits above it, which keeps
+/// the stratification of a Sobol sequence while randomizing it.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed)
+{
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+/// @brief First two dimensions of the Sobol sequence, as 32-bit fractions.
+inline uint32_t sobol_2d(uint32_t index, uint32_t dim)
+{
+  if (dim == 0)
+  {
+    /// van der Corput sequence.
+    return reverse_bits(index);
+  }
+  uint32_t res = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+  {
+    if (index & 1)
+    {
+      res ^= v;
+    }
+  }
+  return res;
+}
+
+/// @brief Random permutation of [0, len) selected by p (Kensler 2013).
+inline uint32_t permute(uint32_t i, uint32_t len, uint32_t p)
+{
+  uint32_t w = len - 1;
+  w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+  do
+  {
+    i ^= p; i *= 0xe170893d; i ^= p >> 16; i ^= (i & w) >> 4;
+    i ^= p >> 8; i *= 0x0929eb3f; i ^= p >> 23; i ^= (i & w) >> 1;
+    i *= 1 | p >> 27; i *= 0x6935fa69; i ^= (i & w) >> 11; i *= 0x74dcb303;
+    i ^= (i & w) >> 2; i *= 0x9e501cc3; i ^= (i & w) >> 2; i *= 0xc860a3df;
+    i &= w; i ^= i >> 5;
+  } while (i >= len);
+  return (i + p) % len;
+}
+
+/// Splits every dimension into count strata and gives each sample of the
+/// pixel its own stratum, in an order shuffled per pixel and dimension.
+class stratified_sampler : public sampler
+{
+  public:
+    virtual float sample(uint32_t key, int i, int j, uint32_t index, uint32_t count, uint32_t dim) const
+    {
+      float jitter = hash_sample(key, index, dim);
+      if (index >= count)
+      {
+        /// Samples beyond the planned count have no stratum left.
+        return jitter;
+      }
+      uint32_t stratum = permute(index, count, hash_u32(key ^ hash_u32(dim + 0x68e31da4u)));
+      /// Rounding can carry the last stratum of a large count up to 1.
+      return std::min((stratum + jitter) / count, SAMPLE_MAX);
+    }
+};
+
+/// Owen scrambled Sobol points. Dimensions are taken in pairs from the
+/// two-dimensional Sobol sequence; each pair of each pixel gets its own
+/// scramble and index shuffle, so pairs stay decorrelated ("padding").
+class sobol_sampler : public sampler
+{
+  public:
+    virtual float sample(uint32_t key, int i, int j, uint32_t index, uint32_t count, uint32_t dim) const
+    {
+      uint32_t seed = hash_u32(key ^ hash_u32((dim >> 1) + 0x5bd1e995u));
+      uint32_t shuffled = owen_scramble(index, seed);
+      uint32_t x = sobol_2d(shuffled, dim & 1);
+      /// bits_to_float already stays below 1.
+      return bits_to_float(owen_scramble(x, hash_u32(seed + (dim & 1) + 1)));
+    }
+};
+
+#define BLUENOISE_SIZE 64
+
+/// Every pixel uses the same scrambled Sobol sequence, toroidally shifted by
+/// a per-pixel offset read from a blue-noise mask (Georgiev and Fajardo,
+/// "Blue-noise dithered sampling"). The remaining error of neighbouring
+/// pixels is then anti-correlated and looks like fine grain, not blotches.
+class bluenoise_sampler : public sampler
+{
+  public:
+    bluenoise_sampler(): mask(BLUENOISE_SIZE * BLUENOISE_SIZE)
+    {
+      generate_mask();
+    }
+
+    virtual float sample(uint32_t key, int i, int j, uint32_t index, uint32_t count, uint32_t dim) const
+    {
+      uint32_t seed = hash_u32((dim >> 1) + 0x5bd1e995u);
+      uint32_t x = sobol_2d(owen_scramble(index, seed), dim & 1);
+      float v = bits_to_float(owen_scramble(x, hash_u32(seed + (dim & 1) + 1)));
+      /// Decorrelate dimensions by reading the mask at a different offset for each.
+      uint32_t h = hash_u32(dim + 0x2c1b3c6du);
+      int mx = (i + (h & 0xff)) & (BLUENOISE_SIZE - 1);
+      int my = (j + ((h >> 8) & 0xff)) & (BLUENOISE_SIZE - 1);
+      v += mask[my * BLUENOISE_SIZE + mx];
+      /// The sum is rounded, so the wrapped value may round up to 1.
+      return std::min(v >= 1 ? v - 1 : v, SAMPLE_MAX);
+    }
+
+  private:
+    /// Rank every mask cell with the void-and-cluster method (Ulichney 1993):
+    /// start from a relaxed sparse pattern, then keep filling the largest
+    /// void. The rank order becomes the threshold value of each cell.
+    void generate_mask()
+    {
+      const int n = BLUENOISE_SIZE, cells = n * n;
+      const float sigma = 1.5;
+      /// Gaussian energy contributed by a point at each toroidal offset.
+      std::vector<float> kernel(cells);
+      for (int y = 0; y < n; y++)
+      {
+        for (int x = 0; x < n; x++)
+        {
+          int dx = std::min(x, n - x), dy = std::min(y, n - y);
+          kernel[y * n + x] = expf(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+      }
+      std::vector<float> energy(cells, 0);
+      std::vector<char> on(cells, 0);
+      auto splat = [&](int c, float sign) {
+        int cx = c % n, cy = c / n;
+        for (int y = 0; y < n; y++)
+        {
+          for (int x = 0; x < n; x++)
+          {
+            energy[y * n + x] += sign * kernel[((y - cy + n) % n) * n + (x - cx + n) % n];
+          }
+        }
+      };
+      auto extreme = [&](bool want_on, bool largest) {
+        int best = -1;
+        for (int c = 0; c < cells; c++)
+        {
+          if (on[c] == want_on && (best < 0 || (largest ? energy[c] > energy[best] : energy[c] < energy[best])))
+          {
+            best = c;
+          }
+        }
+        return best;
+      };
+
+      /// Initial pattern: a tenth of the cells, chosen by hash.
+      int initial = 0;
+      for (int c = 0; c < cells; c++)
+      {
+        if (hash_u32(c + 0x9e3779b9u) % 10 == 0)
+        {
+          on[c] = 1;
+          splat(c, 1);
+          initial++;
+        }
+      }
+      /// Relax: move the tightest cluster into the largest void until stable.
+      for (int iter = 0; iter < cells; iter++)
+      {
+        int cluster = extreme(true, true);
+        on[cluster] = 0;
+        splat(cluster, -1);
+        int gap = extreme(false, false);
+        on[gap] = 1;
+        splat(gap, 1);
+        if (gap == cluster)
+        {
+          break;
+        }
+      }
+      /// Rank the initial points by removing the tightest cluster first.
+      std::vector<char> initial_on = on;
+      std::vector<float> initial_energy = energy;
+      std::vector<int> rank(cells);
+      for (int r = initial - 1; r >= 0; r--)
+      {
+        int cluster = extreme(true, true);
+        on[cluster] = 0;
+        splat(cluster, -1);
+        rank[cluster] = r;
+      }
+      /// Rank the remaining cells by filling the largest void.
+      on = initial_on;
+      energy = initial_energy;
+      for (int r = initial; r < cells; r++)
+      {
+        int gap = extreme(false, false);
+        on[gap] = 1;
+        splat(gap, 1);
+        rank[gap] = r;
+      }
+      for (int c = 0; c < cells; c++)
+      {
+        mask[c] = (rank[c] + 0.5f) / cells;
+      }
+    }
+
+    std::vector<float> mask; /* Blue-noise thresholds in [0, 1). */
+};
+
+/// @brief Shared sampler instance for a sampler type.
+/// @return NULL for SAMPLER_RANDOM, which random_float() handles inline.
+const sampler *get_sampler(int type)
+{
+  static const stratified_sampler stratified;
+  static const sobol_sampler sobol;
+  switch (type)
+  {
+    case SAMPLER_STRATIFIED: return &stratified;
+    case SAMPLER_SOBOL: return &sobol;
+    case SAMPLER_BLUENOISE:
+    {
+      /// Built on first use only, the mask takes a moment to generate.
+      static const bluenoise_sampler bluenoise;
+      return &bluenoise;
+    }
+    default: return NULL;
+  }
+}
+
+/// @brief Look up a sampler type by name.
+/// @return sampler type, or -1 if the name is unknown.
+int parse_sampler(const char *name)
+{
+  for (int t = 0; t < SAMPLER_COUNT; t++)
+  {
+    if (strcmp(sampler_names[t], name) == 0)
+    {
+      return t;
+    }
+  }
+  return -1;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SCENEH
+#define SCENEH
+
+#include <string>
+#include "hitable.h"
+#include "sphere.h"
+#include "materials.h"
+#include "lights.h"
+#include "environment.h"
+#include "keyframes.h"
+#include "bvh.h"
+#include "grid.h"
+
+/// Keyframed motion of one sphere's center. Only a moving_sphere also
+/// moves while the shutter is open; other spheres jump from frame to frame.
+typedef struct object_track
+{
+  sphere *target;
+  track<vec3> center;
+} object_track;
+
+/// Scene class
+/// Everything a render needs besides the frame: the objects, the subset of
+/// them that emit light, and the sky or environment map around them.
+class scene
+{
+  public:
+    /// @brief Take ownership of world and collect its emissive spheres.
+    /// @param w heap allocated world
+    /// @param sky_intensity multiplier applied to the sky gradient
+    scene(hit_list *w, float sky_intensity = 1): world(w), sky(sky_intensity), env(NULL)
+    {
+      for (int i = 0; i < world->size(); i++)
+      {
+        collect_lights(world->get(i));
+      }
+    }
+    ~scene() { delete world; delete env; }
+
+    /// @brief Light the scene with an HDR environment map instead of the sky.
+    /// @param path equirectangular image, +y up
+    /// @param err (OUT) reason for failure
+    bool load_environment(const std::string &path, std::string &err)
+    {
+      environment *e = new environment();
+      if (!e->load(path.c_str(), err))
+      {
+        delete e;
+        return false;
+      }
+      delete env;
+      env = e;
+      return true;
+    }
+
+    /// @brief Move animated objects to their place at time and refit the
+    /// structures containing them.
+    /// @param shutter time the shutter stays open from time on; animated
+    /// objects move over it in a straight line, bounds covering the motion
+    void set_time(float time, float shutter = 0)
+    {
+      for (size_t k = 0; k < motion.size(); k++)
+      {
+        motion[k].target->center = motion[k].center.at(time);
+        moving_sphere *m = dynamic_cast<moving_sphere *>(motion[k].target);
+        if (m)
+        {
+          m->end = shutter > 0 ? motion[k].center.at(time + shutter) : m->center;
+        }
+      }
+      for (size_t k = 0; k < dynamic.size(); k++)
+      {
+        dynamic[k]->refit();
+      }
+    }
+
+  private:
+    /// @brief Add the emissive spheres of h, descending into bvh and grid.
+    /// Emitters inside instances, static worlds or moving spheres are not
+    /// in world space at a fixed place; they are not sampled directly but
+    /// still counted when a path hits them, see light_list::contains.
+    void collect_lights(const hitable *h)
+    {
+      const bvh *b = dynamic_cast<const bvh *>(h);
+      const grid *g = dynamic_cast<const grid *>(h);
+      const sphere *s = dynamic_cast<const sphere *>(h);
+      for (size_t k = 0; b && k < b->size(); k++)
+      {
+        collect_lights(b->get(k));
+      }
+      for (size_t k = 0; g && k < g->size(); k++)
+      {
+        collect_lights(g->get(k));
+      }
+      if (s && !dynamic_cast<const moving_sphere *>(s) && s->mat && s->mat->emitted().squared_length() > 0)
+      {
+        lights.push(s);
+      }
+    }
+
+  public:
+    hit_list *world;   /* Objects of the scene, owned. */
+    light_list lights; /* Emissive spheres sampled for direct lighting. */
+    float sky;         /* Sky radiance multiplier. */
+    environment *env;  /* Environment map replacing the sky, NULL if none. */
+    std::vector<object_track> motion; /* Animated objects. */
+    std::vector<bvh *> dynamic;       /* Hierarchies over animated objects. */
+};
+
+/// @brief Print build statistics of the scene's top level accelerators and
+/// texture cache use to stderr.
+void report_scene(const scene *scn)
+{
+  for (int i = 0; i < scn->world->size(); i++)
+  {
+    const bvh *b = dynamic_cast<const bvh *>(scn->world->get(i));
+    if (b)
+    {
+      const bvh_stats &st = b->stats();
+      fprintf(stderr, "bvh: %zu objects, %s build %.1f ms, SAH cost %.2f, %zu nodes, %zu leaves, depth %d, "
+        "%zu 4-wide nodes %s in %.1f MB\n", b->size(), bvh_names[st.method], st.build_ms, st.sah_cost,
+        st.nodes, st.leaves, st.depth, st.wide_nodes, st.quantized ? "quantized" : "float",
+        st.wide_bytes / 1048576.0);
+    }
+    const grid *g = dynamic_cast<const grid *>(scn->world->get(i));
+    if (g)
+    {
+      const grid_stats &st = g->stats();
+      fprintf(stderr, "grid: %zu objects, build %.1f ms, %dx%dx%d cells (%.0f%% empty), "
+        "%.2f refs per object, %.1f MB\n", g->size(), st.build_ms, st.res[0], st.res[1], st.res[2],
+        100.0 * st.empty / st.cells, double(st.refs) / std::max<size_t>(g->size(), 1), st.bytes / 1048576.0);
+    }
+  }
+  report_textures();
+}
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef SCENESH
+#define SCENESH
+
+#include <string.h>
+#include <string>
+#include "vec3.h"
+#include "sphere.h"
+#include "hitable.h"
+#include "materials.h"
+#include "util.h"
+#include "sampler.h"
+#include "scene.h"
+#include "bvh.h"
+#include "grid.h"
+#include "instance.h"
+#include "static_scene.h"
+
+/// Acceleration structures a scene can hold its many objects in.
+enum accel_kind
+{
+  ACCEL_BVH = 0,  /// Bounding volume hierarchy, see bvh_default for the build
+  ACCEL_GRID,     /// Uniform grid, for many similar objects spread evenly
+  ACCEL_KINDS
+};
+
+static const char *accel_names[ACCEL_KINDS] = {"bvh", "grid"};
+
+/// Accelerator used by every scene instead of its own choice, -1 to keep
+/// the scene's. Set from the command line before scenes are built.
+static int accel_override = -1;
+
+/// @brief Look up an accelerator by name.
+/// @return accel_kind, or -1 if the name is unknown.
+int parse_accel(const char *name)
+{
+  for (int k = 0; k < ACCEL_KINDS; k++)
+  {
+    if (strcmp(accel_names[k], name) == 0)
+    {
+      return k;
+    }
+  }
+  return -1;
+}
+
+/// @brief Put heap allocated objects into an acceleration structure,
+/// which then owns them.
+/// @param accel accel_kind
+hitable *make_accelerator(const std::vector<hitable *> &objects, int accel)
+{
+  if (accel == ACCEL_GRID)
+  {
+    return new grid(objects);
+  }
+  return new bvh(objects);
+}
+
+/// @brief Initialize frame context with default values
+/// @param Frame ctx reference
+void initialize_frame(frame_ctx &frame)
+{
+  /// Define nX and nY by applying resolution to the aspect ratio.
+  frame.nY = IMG_RES;
+  frame.nX = IMG_RES * WIDESCREEN;
+  frame.nS = IMG_SAMPLES;
+  frame.seed = 0;
+  frame.sampling = SAMPLER_RANDOM;
+  frame.shutter = 0;
+  /// Define lookfrom, lookat, vup to position and rotate camera.
+  frame.view.lookfrom = vec3(-2,2,1);
+  frame.view.lookat = vec3(0,0,-1);
+  frame.view.vup = vec3(1,1,0);
+  frame.view.vfov = 90;
+  setup_camera(frame);
+  return;
+}
+
+/// @brief Generate world
+///
+/// Generate a list of hitable objects to display within frame.
+/// @param frame Frame context for frame limits.
+/// @param accel accel_kind for scenes with many objects, unused here.
+hit_list *generate_world(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+
+  /// TODO: Add more objects to hit list.
+  vec3 center = vec3(0,0,-2);
+  float radius = 0.8;
+  // material * matte_green = new lambertian(GREEN);
+  // material * matte_red = new lambertian(red);
+  /// Add matte green "planet" sphere below frame.
+  world->push(
+    new sphere(
+      vec3(0, -(100 + radius), -1),
+      100,
+      new lambertian(GREEN)
+    ));
+  /// Add matte red sphere front and center
+  world->push(
+    (hitable *) new sphere(
+      center,
+      radius,
+      new lambertian(RED)
+    ));
+  /// Add metal blue sphere to the left
+  world->push(
+    (hitable *) new sphere(
+      center - vec3(2 * radius,0,0),
+      radius,
+      new metal(SKYBLUE)
+    ));
+  /// Add glass sphere to the right
+  world->push(
+    (hitable *) new sphere(
+      center + vec3(2 * radius,0,0),
+      radius,
+      new dielectric(DIAMOND_IDX)
+    ));
+
+
+  return world;
+}
+
+/// @brief Generate the default spheres lit by two emissive spheres under a
+/// dim sky, a scene that mostly receives its light from small sources.
+/// @param frame Frame context for frame limits.
+hit_list *generate_lit_world(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = generate_world(frame, accel, texture_path);
+  /// Add warm light above and behind the red sphere
+  world->push(
+    new sphere(
+      vec3(0.6, 2.2, -2.6),
+      0.35,
+      new diffuse_light(vec3(16, 13, 10))
+    ));
+  /// Add small cool light low on the left
+  world->push(
+    new sphere(
+      vec3(-2.6, 0.2, -0.6),
+      0.2,
+      new diffuse_light(vec3(4, 6, 12))
+    ));
+  return world;
+}
+
+/// @brief The default layout as a static_world, its four spheres fixed at
+/// compile time. Renders the same image as generate_world.
+/// @param frame Frame context for frame limits.
+hit_list *generate_fixed_world(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+  vec3 center = vec3(0,0,-2);
+  float radius = 0.8;
+  world->push(make_static_world(
+    fixed_sphere(vec3(0, -(100 + radius), -1), 100, new lambertian(GREEN)),
+    fixed_sphere(center, radius, new lambertian(RED)),
+    fixed_sphere(center - vec3(2 * radius,0,0), radius, new metal(SKYBLUE)),
+    fixed_sphere(center + vec3(2 * radius,0,0), radius, new dielectric(DIAMOND_IDX))));
+  return world;
+}
+
+/// @brief Generate the default layout with latitude-longitude textured
+/// spheres, sampling their texture through the shared texture cache.
+/// @param frame Frame context for frame limits.
+/// @param texture_path image mapped onto the spheres, a checker pattern when empty
+hit_list *generate_textured_world(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+  vec3 center = vec3(0,0,-2);
+  float radius = 0.8;
+  auto surface = [&texture_path](const vec3 &tint) -> texture * {
+    if (texture_path.empty())
+    {
+      return new checker_texture(tint, WHITE, 8);
+    }
+    return new image_texture(texture_path);
+  };
+  /// Add matte "planet" sphere below frame.
+  world->push(
+    new sphere(
+      vec3(0, -(100 + radius), -1),
+      100,
+      new lambertian(GREYSCALE(0.5))
+    ));
+  /// Add three textured spheres side by side
+  for (int k = -1; k <= 1; k++)
+  {
+    world->push(
+      new sphere(
+        center + vec3(2 * k * radius, 0, 0),
+        radius,
+        new lambertian(surface(k < 0 ? RED : k > 0 ? BLUE : GREEN))
+      ));
+  }
+  return world;
+}
+
+#define FOREST_SIDE 200 /// Trees per side of the forest grid
+
+/// @brief Build the shared tree geometry: a trunk and a canopy of spheres,
+/// standing on the origin, in a bvh of its own.
+std::shared_ptr<const hitable> make_tree()
+{
+  std::vector<hitable *> parts;
+  vec3 bark(0.35, 0.2, 0.1), leaves(0.1, 0.45, 0.12);
+  for (int k = 0; k < 3; k++)
+  {
+    parts.push_back(new sphere(vec3(0, 0.12 + 0.2 * k, 0), 0.08, new lambertian(bark)));
+  }
+  parts.push_back(new sphere(vec3(0, 0.75, 0), 0.3, new lambertian(leaves)));
+  parts.push_back(new sphere(vec3(0.12, 0.95, 0.05), 0.2, new lambertian(leaves)));
+  parts.push_back(new sphere(vec3(-0.08, 1.05, -0.06), 0.17, new lambertian(leaves)));
+  return std::shared_ptr<const hitable>(new bvh(parts));
+}
+
+/// @brief Generate a forest: FOREST_SIDE^2 instances of one tree, each
+/// placed, turned and scaled by its own transform, under a top level
+/// accelerator.
+/// @param frame Frame context for frame limits.
+/// @param accel accel_kind holding the trees
+hit_list *generate_forest(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+  float ground = 100, spacing = 0.4;
+  vec3 ground_center(0, -(ground + 0.8), -1);
+  world->push(new sphere(ground_center, ground, new lambertian(vec3(0.3, 0.25, 0.15))));
+  std::shared_ptr<const hitable> tree = make_tree();
+  std::vector<hitable *> trees;
+  trees.reserve(FOREST_SIDE * FOREST_SIDE);
+  for (int iz = 0; iz < FOREST_SIDE; iz++)
+  {
+    for (int ix = 0; ix < FOREST_SIDE; ix++)
+    {
+      /// Jitter, turn and scale every tree by hashing its grid cell.
+      uint32_t h = hash_u32(iz * FOREST_SIDE + ix);
+      float jx = bits_to_float(h) - 0.5f, jz = bits_to_float(hash_u32(h)) - 0.5f;
+      float x = (ix - FOREST_SIDE / 2 + jx) * spacing;
+      float z = -1 - (iz + jz) * spacing;
+      /// Stand on the ground sphere.
+      float dx = x - ground_center.x(), dz = z - ground_center.z();
+      float y = ground_center.y() + sqrtf(ground * ground - dx * dx - dz * dz);
+      float turn = 2 * float(M_PI) * bits_to_float(hash_u32(h + 1));
+      float size = 0.6f + 0.6f * bits_to_float(hash_u32(h + 2));
+      trees.push_back(new instance(tree, affine::place(vec3(x, y, z), turn, size)));
+    }
+  }
+  world->push(make_accelerator(trees, accel));
+  return world;
+}
+
+#define ORBIT_SPHERES 64 /// Moons circling the orbit scene
+#define ORBIT_PERIOD 48   /// Frames per revolution of the innermost moon
+
+/// @brief Generate a mirror sphere circled by small moons held in a bvh.
+/// The moons start at rest, rig_orbit sets them in motion.
+/// @param frame Frame context for frame limits.
+/// @param accel ignored, moving moons need a refittable bvh
+hit_list *generate_orbit(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+  world->push(new sphere(vec3(0, -100.8, -1), 100, new lambertian(GREYSCALE(0.5))));
+  world->push(new sphere(vec3(0, 0, -2), 0.6, new metal(WHITE, 0.05)));
+  std::vector<hitable *> moons;
+  for (int k = 0; k < ORBIT_SPHERES; k++)
+  {
+    uint32_t h = hash_u32(k + 0x6f726269u);
+    vec3 tint(bits_to_float(h), bits_to_float(hash_u32(h)), bits_to_float(hash_u32(h + 1)));
+    moons.push_back(new moving_sphere(vec3(0, 0, -2), vec3(0, 0, -2),
+      0.06 + 0.06 * bits_to_float(hash_u32(h + 2)), new lambertian(tint)));
+  }
+  world->push(new bvh(moons));
+  return world;
+}
+
+/// @brief Key the moons of generate_orbit onto circles, one key every
+/// eighth of a revolution, and mark their bvh for refitting.
+void rig_orbit(scene &scn)
+{
+  for (int i = 0; i < scn.world->size(); i++)
+  {
+    bvh *moons = dynamic_cast<bvh *>(scn.world->get(i));
+    if (!moons)
+    {
+      continue;
+    }
+    for (size_t k = 0; k < moons->size(); k++)
+    {
+      object_track t;
+      t.target = dynamic_cast<moving_sphere *>(moons->get(k));
+      if (!t.target)
+      {
+        continue;
+      }
+      uint32_t h = hash_u32(k + 0x72696767u);
+      float radius = 0.9f + 1.2f * bits_to_float(h);
+      float height = 0.6f * bits_to_float(hash_u32(h)) - 0.2f;
+      float phase = 2 * float(M_PI) * bits_to_float(hash_u32(h + 1));
+      /// Kepler-like: outer moons are slower.
+      float period = ORBIT_PERIOD * powf(radius / 0.9f, 1.5f);
+      for (int key = 0; key <= 64; key++)
+      {
+        float time = key * period / 8;
+        float a = phase + 2 * float(M_PI) * key / 8;
+        t.center.add(time, vec3(radius * cosf(a), height, -2 + radius * sinf(a)));
+      }
+      scn.motion.push_back(t);
+    }
+    scn.dynamic.push_back(moons);
+  }
+}
+
+#define PARTICLE_COUNT 200000 /// Spheres of the particles scene
+
+/// @brief Generate a cloud of similar-sized particles filling a box
+/// evenly, the kind of scene a uniform grid handles well.
+/// @param frame Frame context for frame limits.
+/// @param accel accel_kind holding the particles
+hit_list *generate_particles(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = new hit_list();
+  world->push(new sphere(vec3(0, -101.5, -1), 100, new lambertian(GREYSCALE(0.5))));
+  std::vector<hitable *> particles;
+  particles.reserve(PARTICLE_COUNT);
+  for (int k = 0; k < PARTICLE_COUNT; k++)
+  {
+    uint32_t h = hash_u32(k + 0x70617274u);
+    vec3 c(bits_to_float(h), bits_to_float(hash_u32(h)), bits_to_float(hash_u32(h + 1)));
+    vec3 tint(0.3f + 0.7f * c.x(), 0.3f + 0.7f * c.y(), 0.3f + 0.7f * c.z());
+    particles.push_back(new sphere(vec3(6, 3, 6) * c - vec3(3, 1.5, 6), 0.012 + 0.004 * bits_to_float(hash_u32(h + 2)),
+      new lambertian(tint)));
+  }
+  world->push(make_accelerator(particles, accel));
+  return world;
+}
+
+#define BOUNCING_SPHERES 400 /// Balls of the motion scene
+
+/// @brief Generate the default layout on a floor of bouncing balls, each
+/// moving up and sideways for as long as the shutter is open. Without a
+/// shutter the balls render sharp, resting on the ground.
+/// @param frame Frame context, frame.shutter scales the motion
+/// @param accel accel_kind holding the balls
+hit_list *generate_motion_world(const frame_ctx &frame, int accel, const std::string &texture_path)
+{
+  hit_list *world = generate_world(frame, accel, texture_path);
+  std::vector<hitable *> balls;
+  for (int k = 0; k < BOUNCING_SPHERES; k++)
+  {
+    uint32_t h = hash_u32(k + 0x626f756eu);
+    float radius = 0.04f + 0.04f * bits_to_float(hash_u32(h + 3));
+    vec3 start(8 * bits_to_float(h) - 4, radius - 0.8f, -6 * bits_to_float(hash_u32(h)) + 1);
+    vec3 velocity(0.2f * bits_to_float(hash_u32(h + 4)) - 0.1f, 0.6f * bits_to_float(hash_u32(h + 1)), 0);
+    vec3 tint(0.3f + 0.7f * bits_to_float(hash_u32(h + 2)), 0.3f, 0.3f + 0.7f * bits_to_float(hash_u32(h + 5)));
+    balls.push_back(new moving_sphere(start, start + frame.shutter * velocity, radius, new lambertian(tint)));
+  }
+  world->push(make_accelerator(balls, accel));
+  return world;
+}
+
+/// Scene registry entry, maps a scene name to the function building it.
+typedef hit_list *(*scene_builder)(const frame_ctx &frame, int accel, const std::string &texture_path);
+/// Registers the keyframed motion of a freshly built scene.
+typedef void (*scene_rigger)(scene &scn);
+typedef struct scene_entry
+{
+  const char *name;
+  scene_builder build;
+  float sky;  /// Sky radiance multiplier
+  scene_rigger rig;  /// NULL for static scenes
+  int accel;  /// accel_kind unless overridden by accel_override
+} scene_entry;
+
+/// Named scenes that can be requested from the command line or a daemon job.
+static const scene_entry scene_table[] = {
+  {"default", generate_world, 1, NULL, ACCEL_BVH},
+  {"fixed", generate_fixed_world, 1, NULL, ACCEL_BVH},
+  {"lights", generate_lit_world, 0.05, NULL, ACCEL_BVH},
+  {"textured", generate_textured_world, 1, NULL, ACCEL_BVH},
+  {"forest", generate_forest, 1, NULL, ACCEL_BVH},
+  {"orbit", generate_orbit, 1, rig_orbit, ACCEL_BVH},
+  {"particles", generate_particles, 1, NULL, ACCEL_GRID},
+  {"motion", generate_motion_world, 1, NULL, ACCEL_BVH},
+  {NULL, NULL, 0, NULL, ACCEL_BVH}
+};
+
+/// @brief Build a registered scene by name.
+/// @param texture_path image for scenes that map one, empty for their default
+/// @return heap allocated scene, or NULL if no scene has that name.
+scene *build_scene(const char *name, const frame_ctx &frame, const std::string &texture_path = std::string())
+{
+  for (int i = 0; scene_table[i].name; i++)
+  {
+    if (strcmp(scene_table[i].name, name) == 0)
+    {
+      int accel = accel_override >= 0 ? accel_override : scene_table[i].accel;
+      scene *scn = new scene(scene_table[i].build(frame, accel, texture_path), scene_table[i].sky);
+      if (scene_table[i].rig)
+      {
+        scene_table[i].rig(*scn);
+        scn->set_time(0, frame.shutter);
+      }
+      return scn;
+    }
+  }
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef SERVERH
+#define SERVERH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <map>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "util.h"
+#include "hitable.h"
+#include "render.h"
+#include "scenes.h"
+#include "output.h"
+#include "net.h"
+#include "sampler.h"
+
+/// Render job description, sent to the daemon as one text line:
+///   render scene=default w=640 h=360 spp=50 seed=0 sampler=random priority=0
+///          from=-2,2,1 at=0,0,-1 up=1,1,0 fov=90 out=file.ppm
+typedef struct render_job
+{
+  std::string scene;  /// Registered scene name
+  std::string out;    /// Output path, written by the daemon
+  std::string env;    /// Environment map path, empty for the scene's sky
+  std::string texture;  /// Image of scenes that map one, empty for their default
+  int priority;       /// Larger values are rendered first
+  frame_ctx frame;    /// Resolution, samples, seed and view
+} render_job;
+
+/// @brief Initialize a job with the default scene and frame.
+void initialize_job(render_job &job)
+{
+  job.scene = "default";
+  job.out = "file.ppm";
+  job.env = "";
+  job.texture = "";
+  job.priority = 0;
+  initialize_frame(job.frame);
+}
+
+/// @brief Serialize a job into its protocol line.
+std::string format_job(const render_job &job)
+{
+  const view_params &v = job.frame.view;
+  std::ostringstream os;
+  /// Enough digits to round trip every float, remote renders must match.
+  os << std::setprecision(9);
+  os << "render scene=" << job.scene
+     << " w=" << job.frame.nX << " h=" << job.frame.nY
+     << " spp=" << job.frame.nS << " seed=" << job.frame.seed
+     << " sampler=" << sampler_names[job.frame.sampling]
+     << " priority=" << job.priority
+     << " from=" << v.lookfrom.x() << "," << v.lookfrom.y() << "," << v.lookfrom.z()
+     << " at=" << v.lookat.x() << "," << v.lookat.y() << "," << v.lookat.z()
+     << " up=" << v.vup.x() << "," << v.vup.y() << "," << v.vup.z()
+     << " fov=" << v.vfov
+     << " out=" << job.out;
+  if (job.frame.shutter > 0)
+  {
+    os << " shutter=" << job.frame.shutter;
+  }
+  if (!job.env.empty())
+  {
+    os << " env=" << job.env;
+  }
+  if (!job.texture.empty())
+  {
+    os << " texture=" << job.texture;
+  }
+  return os.str();
+}
+
+/// @brief Parse the key=value fields of a protocol line into job.
+///
+/// Fields that are not given keep their current value.
+/// @param fields text after the "render" command word
+/// @param job (IN/OUT) job to update
+/// @param err (OUT) reason for failure
+/// @return true iff every field was understood.
+bool parse_job(const std::string &fields, render_job &job, std::string &err)
+{
+  std::istringstream is(fields);
+  std::string field;
+  while (is >> field)
+  {
+    size_t eq = field.find('=');
+    if (eq == std::string::npos)
+    {
+      err = "malformed field " + field;
+      return false;
+    }
+    std::string key = field.substr(0, eq);
+    const char *val = field.c_str() + eq + 1;
+    bool ok = true;
+    if (key == "scene") job.scene = val;
+    else if (key == "out") job.out = val;
+    else if (key == "env") job.env = val;
+    else if (key == "texture") job.texture = val;
+    else if (key == "w") ok = parse_count(val, MAX_RESOLUTION, job.frame.nX);
+    else if (key == "h") ok = parse_count(val, MAX_RESOLUTION, job.frame.nY);
+    else if (key == "spp") ok = parse_count(val, MAX_SAMPLES, job.frame.nS);
+    else if (key == "seed") job.frame.seed = strtoul(val, NULL, 10);
+    else if (key == "sampler") ok = (job.frame.sampling = parse_sampler(val)) >= 0;
+    else if (key == "priority") job.priority = atoi(val);
+    else if (key == "from") ok = parse_vec3(val, job.frame.view.lookfrom);
+    else if (key == "at") ok = parse_vec3(val, job.frame.view.lookat);
+    else if (key == "up") ok = parse_vec3(val, job.frame.view.vup);
+    else if (key == "fov") ok = (job.frame.view.vfov = atof(val)) > 0;
+    else if (key == "shutter") ok = (job.frame.shutter = atof(val)) >= 0 && job.frame.shutter <= 1;
+    else
+    {
+      err = "unknown field " + key;
+      return false;
+    }
+    if (!ok)
+    {
+      err = "bad value for " + key;
+      return false;
+    }
+  }
+  setup_camera(job.frame);
+  return true;
+}
+
+/// Scene cache class
+/// Keeps every world built by the daemon alive between jobs, so repeated
+/// renders of a scene skip construction. Worlds are only read while
+/// rendering and can be shared by concurrent jobs. A world is built
+/// outside the cache lock: jobs for other scenes go ahead meanwhile, and
+/// jobs for the same scene wait for that one build.
+class scene_cache
+{
+  public:
+    ~scene_cache()
+    {
+      std::map<std::string, std::shared_future<build_result>>::iterator it;
+      for (it = scenes.begin(); it != scenes.end(); it++)
+      {
+        delete it->second.get().scn;
+      }
+    }
+
+    /// @brief Look up the scene of a job, building it on first use.
+    ///
+    /// Scenes are cached per scene name, environment map, texture and
+    /// shutter, which sets how far moving objects travel. A failed build is not cached.
+    /// @param job job naming the scene, environment and frame
+    /// @param built (OUT) true iff this call constructed the scene
+    /// @param err (OUT) reason for failure
+    /// @return cached scene, or NULL if it cannot be built.
+    const scene *get(const render_job &job, bool &built, std::string &err)
+    {
+      std::string key = cache_key(job);
+      std::promise<build_result> promise;
+      std::shared_future<build_result> pending;
+      built = false;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::map<std::string, std::shared_future<build_result>>::iterator it = scenes.find(key);
+        if (it != scenes.end())
+        {
+          pending = it->second;
+        } else
+        {
+          pending = promise.get_future().share();
+          scenes[key] = pending;
+          built = true;
+        }
+      }
+      if (!built)
+      {
+        const build_result &res = pending.get();
+        err = res.err;
+        return res.scn;
+      }
+      build_result res;
+      res.scn = build_scene(job.scene.c_str(), job.frame, job.texture);
+      if (!res.scn)
+      {
+        res.err = "unknown scene " + job.scene;
+      } else if (!job.env.empty() && !res.scn->load_environment(job.env, res.err))
+      {
+        delete res.scn;
+        res.scn = NULL;
+      }
+      if (!res.scn)
+      {
+        /// Jobs already waiting get the error, later ones try again.
+        std::lock_guard<std::mutex> lock(mtx);
+        scenes.erase(key);
+        built = false;
+      }
+      promise.set_value(res);
+      err = res.err;
+      return res.scn;
+    }
+
+    /// @brief Space separated names of cached scenes, including those
+    /// still being built.
+    std::string names()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      std::string res;
+      std::map<std::string, std::shared_future<build_result>>::iterator it;
+      for (it = scenes.begin(); it != scenes.end(); it++)
+      {
+        res += (res.empty() ? "" : " ") + it->first;
+      }
+      return res;
+    }
+
+  private:
+    /// @brief "scene", "scene@env", with "#texture" appended if one is
+    /// given and "~shutter" if the shutter is open.
+    static std::string cache_key(const render_job &job)
+    {
+      std::string key = job.env.empty() ? job.scene : job.scene + "@" + job.env;
+      if (!job.texture.empty())
+      {
+        key += "#" + job.texture;
+      }
+      if (job.frame.shutter > 0)
+      {
+        std::ostringstream os;
+        os << std::setprecision(9) << job.frame.shutter;
+        key += "~" + os.str();
+      }
+      return key;
+    }
+
+    /// Outcome of one scene build, shared with every job waiting for it.
+    typedef struct build_result
+    {
+      scene *scn;       /// NULL if the build failed
+      std::string err;  /// Reason for failure
+    } build_result;
+
+    std::mutex mtx;
+    std::map<std::string, std::shared_future<build_result>> scenes;  /* Built or building, by cache_key. */
+};
+
+/// Render server class
+/// Long running daemon accepting render jobs on a Unix domain socket or,
+/// given "host:port", on TCP.
+/// Each connection is served by its own thread; the rows of every job run
+/// on the shared render pool at the job's priority. Replies are lines:
+///   progress <percent>     while rendering
+///   done <out> <ms>        once the image is written
+///   error <reason>         if the job failed
+/// "tile x0 y0 x1 y1 <fields>" renders only that tile of the job and answers
+/// "tile x0 y0 x1 y1" followed by the raw row-major float pixels, which lets
+/// the daemon act as a worker for distributed renders.
+/// Other commands: "scenes" lists cached scenes, "quit" closes the connection.
+/// Images are only written below the output directory: out= must be a
+/// relative path without ".." components.
+class render_server
+{
+  public:
+    render_server(const char *socket_path, const char *output_dir = "."):
+      path(socket_path), out_dir(output_dir) {}
+
+    /// @brief Accept connections until the listening socket fails.
+    /// @return non-zero if the socket could not be opened.
+    int run()
+    {
+      int listen_fd = listen_addr(path.c_str());
+      if (listen_fd < 0)
+      {
+        std::cerr << "Could not listen on " << path << "\n";
+        return 1;
+      }
+      std::cerr << "Render daemon listening on " << path << " with "
+                << shared_pool().size() << " threads\n";
+      for (;;)
+      {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+          break;
+        }
+        std::thread(&render_server::serve, this, fd).detach();
+      }
+      close(listen_fd);
+      return 0;
+    }
+
+  private:
+    /// Handle commands on one connection until the client leaves.
+    void serve(int fd)
+    {
+      std::string line;
+      bool too_long;
+      while (recv_line(fd, line, &too_long))
+      {
+        std::string cmd = line.substr(0, line.find(' '));
+        if (cmd == "render")
+        {
+          std::string fields = line.size() > cmd.size() ? line.substr(cmd.size() + 1) : "";
+          if (!run_job(fd, fields))
+          {
+            break;
+          }
+        } else if (cmd == "tile")
+        {
+          if (!run_tile(fd, line.substr(cmd.size())))
+          {
+            break;
+          }
+        } else if (cmd == "scenes")
+        {
+          send_line(fd, "scenes " + cache.names());
+        } else if (cmd == "quit")
+        {
+          break;
+        } else if (!send_line(fd, "error unknown command " + cmd))
+        {
+          break;
+        }
+      }
+      if (too_long)
+      {
+        send_line(fd, "error line too long");
+      }
+      close(fd);
+    }
+
+    /// @brief Whether a client supplied path stays inside the output directory.
+    static bool contained_path(const std::string &out)
+    {
+      if (out.empty() || out[0] == '/')
+      {
+        return false;
+      }
+      size_t start = 0;
+      for (;;)
+      {
+        size_t end = out.find('/', start);
+        if (out.compare(start, end == std::string::npos ? std::string::npos : end - start, "..") == 0)
+        {
+          return false;
+        }
+        if (end == std::string::npos)
+        {
+          return true;
+        }
+        start = end + 1;
+      }
+    }
+
+    /// @brief Render one job, streaming progress to the client.
+    /// @return false once the client is gone.
+    bool run_job(int fd, const std::string &fields)
+    {
+      render_job job;
+      std::string err;
+      initialize_job(job);
+      if (!parse_job(fields, job, err))
+      {
+        return send_line(fd, "error " + err);
+      }
+      if (!contained_path(job.out))
+      {
+        return send_line(fd, "error out must be relative, without ..");
+      }
+      bool built;
+      const scene *scn = cache.get(job, built, err);
+      if (!scn)
+      {
+        return send_line(fd, "error " + err);
+      }
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      /// Progress is reported from pool workers, one line per new percent.
+      std::mutex send_mtx;
+      int last_percent = -1;
+      bool connected = true;
+      size_t nY = job.frame.nY;
+      progress_fn progress = [&](size_t rows) {
+        int percent = rows * 100 / nY;
+        std::lock_guard<std::mutex> lock(send_mtx);
+        if (percent > last_percent && connected)
+        {
+          last_percent = percent;
+          connected = send_line(fd, "progress " + std::to_string(percent));
+        }
+      };
+
+      vec3 **image = allocate_image(job.frame);
+      render_image(scn, job.frame, image, job.priority, progress);
+      int res = write_image((out_dir + "/" + job.out).c_str(), image, job.frame);
+      destroy_image(image, job.frame);
+      if (res != 0)
+      {
+        return send_line(fd, "error could not write " + job.out);
+      }
+      long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+      return connected && send_line(fd, "done " + job.out + " " + std::to_string(ms));
+    }
+
+    /// @brief Render one tile of a job and send its pixels back.
+    /// @return false once the client is gone.
+    bool run_tile(int fd, const std::string &args)
+    {
+      render_job job;
+      tile_rect t;
+      std::string err;
+      std::istringstream is(args);
+      initialize_job(job);
+      if (!(is >> t.x0 >> t.y0 >> t.x1 >> t.y1))
+      {
+        return send_line(fd, "error malformed tile");
+      }
+      std::string fields;
+      std::getline(is, fields);
+      if (!parse_job(fields, job, err))
+      {
+        return send_line(fd, "error " + err);
+      }
+      if (t.x0 < 0 || t.y0 < 0 || t.x1 > int(job.frame.nX) || t.y1 > int(job.frame.nY)
+          || t.width() <= 0 || t.height() <= 0)
+      {
+        return send_line(fd, "error tile outside frame");
+      }
+      bool built;
+      const scene *scn = cache.get(job, built, err);
+      if (!scn)
+      {
+        return send_line(fd, "error " + err);
+      }
+      std::vector<vec3> pixels(t.width() * t.height());
+      render_tile(scn, job.frame, t, pixels.data(), job.priority);
+      std::ostringstream os;
+      os << "tile " << t.x0 << " " << t.y0 << " " << t.x1 << " " << t.y1;
+      return send_line(fd, os.str())
+          && send_all(fd, pixels.data(), pixels.size() * sizeof(vec3));
+    }
+
+    std::string path;     /* Socket path or TCP address. */
+    std::string out_dir;  /* Directory job images are written to. */
+    scene_cache cache;    /* Worlds built so far, by scene name. */
+};
+
+/// @brief Send a job to a running daemon and echo its replies.
+/// @param socket_path daemon socket or TCP address
+/// @param job job to render
+/// @return 0 iff the daemon reported the job done.
+int submit_job(const char *socket_path, const render_job &job)
+{
+  int fd = connect_addr(socket_path);
+  if (fd < 0)
+  {
+    std::cerr << "Could not connect to " << socket_path << "\n";
+    return 1;
+  }
+  int res = 1;
+  std::string line;
+  if (send_line(fd, format_job(job)))
+  {
+    while (recv_line(fd, line))
+    {
+      std::cout << line << std::endl;
+      if (line.compare(0, 5, "done ") == 0)
+      {
+        res = 0;
+        break;
+      }
+      if (line.compare(0, 6, "error ") == 0)
+      {
+        break;
+      }
+    }
+  }
+  send_line(fd, "quit");
+  close(fd);
+  return res;
+}
+
+#endif
@@ -19,12 +19,42 @@ class sphere : public hitable
     }
     virtual ~sphere() {delete mat;} /// Free material pointer.
     float radius() const { return rad; }
+    inline bool intersect(const ray &r, const vec3 &pos, float &t) const;
+    inline bool intersect(const ray &r, float &t) const { return intersect(r, center, t); }
+    inline void shade(const ray &r, hit_record &rec, const vec3 &c) const;
     virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    virtual bool occluded(const ray &r, float t_min, float t_max) const;
+    virtual void finalize(const ray &r, hit_record &rec) const;
+    virtual bool bounding_box(aabb &box) const
+    {
+      vec3 extent(rad, rad, rad);
+      box = aabb(center - extent, center + extent);
+      return true;
+    }
     vec3 center;
     float rad;
     material *mat;
 };
 
+/// @brief Nearer root of the intersection equation below, for the sphere
+/// centered at pos.
+/// @param t (OUT) distance along r, set only if r meets the sphere
+/// @return false if r misses the sphere.
+inline bool sphere::intersect(const ray &r, const vec3 &pos, float &t) const
+{
+  vec3 oc = r.origin() - pos;
+  float a = dot(r.direction(), r.direction());
+  float b = 2 * dot(r.direction(), oc);
+  float c = dot(oc, oc) - (rad * rad);
+  float det = (b * b) - (4 * a * c);
+  if (det <= 0)
+  {
+    return false;
+  }
+  t = (- b - sqrt(det)) / (2*a);
+  return true;
+}
+
 /// @brief Sphere hit method
 ///
 /// Overloaded hitable hit method. Uses sphere intersection equation:
@@ -34,34 +64,88 @@ class sphere : public hitable
 /// we have an intersection!
 bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
 {
-  vec3 oc = r.origin() - center;
-  float a = dot(r.direction(), r.direction());
-  float b = 2 * dot(r.direction(), oc);
-  float c = dot(oc, oc) - (rad * rad);
-  float det = (b * b) - (4 * a * c);
-  if (det > 0)
+  float t;
+  /// Ensure t is within given bounds.
+  if (intersect(r, t) && t_min < t && t < t_max)
   {
-    /// Ensure t is within given bounds. 
-    float t = (- b - sqrt(det)) / (2*a);
-    if (t_min < t && t < t_max)
+    /// Sphere was hit! The rest is left to finalize.
+    rec.t = t;
+    rec.obj = this;
+    return true;
+  }
+  return false;
+}
+
+/// @brief Fill in the shade data of a hit found by sphere::hit.
+void sphere::finalize(const ray &r, hit_record &rec) const
+{
+  shade(r, rec, center);
+}
+
+/// @brief Shade data of a hit on the sphere centered at c.
+inline void sphere::shade(const ray &r, hit_record &rec, const vec3 &c) const
+{
+  /// Hit point P(t) can be computed from the ray
+  rec.p = r.point_at_parameter(rec.t);
+  /// Compute normal = unit vector of P - C
+  rec.normal =  (rec.p - c) / radius();
+  /// Assign material to hit record.
+  rec.mat = mat;
+  /// Latitude-longitude texture coordinates, v = 0 at the top.
+  rec.u = 0.5f + atan2f(rec.normal.x(), -rec.normal.z()) / (2 * float(M_PI));
+  rec.v = acosf(fmaxf(-1, fminf(1, rec.normal.y()))) / float(M_PI);
+  /// u spans the circumference, a 2:1 texture has square texels.
+  rec.duv = r.footprint(rec.t) / (2 * float(M_PI) * rad);
+}
+
+/// @brief Sphere occlusion test
+///
+/// Same intersection as sphere::hit, without computing the hit point,
+/// normal and material.
+bool sphere::occluded(const ray &r, float t_min, float t_max) const
+{
+  float t;
+  return intersect(r, t) && t_min < t && t < t_max;
+}
+
+/// Sphere moving in a straight line while the shutter is open, from center
+/// at ray time 0 to end at ray time 1. Bounds hold the whole motion, so a
+/// single bvh or grid serves every time sample. An emissive moving sphere
+/// is not light-sampled, its emission only counts when a path hits it.
+class moving_sphere : public sphere
+{
+  public:
+    moving_sphere(const vec3 &start, const vec3 &stop, const float radius, material *m):
+      sphere(start, radius, m), end(stop) {}
+    inline vec3 center_at(float time) const { return center + time * (end - center); }
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const
     {
-      /// Sphere was hit! 
-      rec.t = t;
-      /// Hit point P(t) can be computed from the ray
-      rec.p = r.point_at_parameter(rec.t);
-      /// Compute normal = unit vector of P - C
-      rec.normal =  (rec.p - center) / radius();
-      /// Assign material to hit record.
-      rec.mat = mat;
-      return true;
-    } else {
+      float t;
+      if (intersect(r, center_at(r.time), t) && t_min < t && t < t_max)
+      {
+        rec.t = t;
+        rec.obj = this;
+        return true;
+      }
       return false;
     }
-  } else 
-  {
-    return false;
-  }
-}
+    virtual bool occluded(const ray &r, float t_min, float t_max) const
+    {
+      float t;
+      return intersect(r, center_at(r.time), t) && t_min < t && t < t_max;
+    }
+    virtual void finalize(const ray &r, hit_record &rec) const { shade(r, rec, center_at(r.time)); }
+    virtual bool bounding_box(aabb &box) const
+    {
+      vec3 extent(rad, rad, rad);
+      box = aabb(center - extent, center + extent);
+      box.extend(aabb(end - extent, end + extent));
+      return true;
+    }
+
+    vec3 end;  /// Center when the shutter closes
+};
 
 inline std::istream& operator>>(std::istream &is, sphere &v)
 {
@@ -0,0 +1,113 @@
+#ifndef STATICSCENEH
+#define STATICSCENEH
+
+#include <stddef.h>
+#include <tuple>
+#include <utility>
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+#include "sphere.h"
+
+/// Sphere whose exact type is known wherever it is stored. Being final,
+/// calls through a fixed_sphere bind statically and can be inlined.
+class fixed_sphere final : public sphere
+{
+  public:
+    fixed_sphere(const vec3 &position, float radius, material *m): sphere(position, radius, m) {}
+    /// Moves hand the material over, only one sphere may delete it.
+    fixed_sphere(fixed_sphere &&s): sphere(s.center, s.rad, s.mat) { s.mat = NULL; }
+    fixed_sphere(const fixed_sphere &) = delete;
+
+    /// Same tests as sphere, defined here so they inline into static_world.
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+    {
+      float t;
+      if (intersect(r, t) && t_min < t && t < t_max)
+      {
+        rec.t = t;
+        rec.obj = this;
+        return true;
+      }
+      return false;
+    }
+    virtual bool occluded(const ray &r, float t_min, float t_max) const
+    {
+      float t;
+      return intersect(r, t) && t_min < t && t < t_max;
+    }
+};
+
+/// Static world class
+/// A set of objects fixed at compile time, held by value in a tuple. The
+/// loops of hit and occluded expand into one statically bound, inlinable
+/// test per object, where a hit_list makes a virtual call through a heap
+/// pointer for each. Suits small scenes known when the renderer is built.
+///
+/// Objects finalize their own hits like in a hit_list. Emitters inside a
+/// static world are never light-sampled, only counted when a path hits
+/// them, so small lights belong in the outer hit_list.
+template <class... P>
+class static_world : public hitable
+{
+  public:
+    static_world(P &&... objects): prims(std::move(objects)...) {}
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+    {
+      return hit_each(r, t_min, t_max, rec, std::index_sequence_for<P...>());
+    }
+
+    virtual bool occluded(const ray &r, float t_min, float t_max) const
+    {
+      return occluded_each(r, t_min, t_max, std::index_sequence_for<P...>());
+    }
+
+    virtual void finalize(const ray &r, hit_record &rec) const { rec.obj->finalize(r, rec); }
+
+    virtual bool bounding_box(aabb &box) const
+    {
+      return bounds_each(box, std::index_sequence_for<P...>());
+    }
+
+    static constexpr size_t size() { return sizeof...(P); }
+
+  private:
+    /// @brief Closest hit, objects in declaration order like hit_list::hit.
+    template <size_t... I>
+    inline bool hit_each(const ray &r, float t_min, float t_max, hit_record &rec,
+      std::index_sequence<I...>) const
+    {
+      bool did_hit = false;
+      ((std::get<I>(prims).hit(r, t_min, t_max, rec) ? (did_hit = true, t_max = rec.t) : 0), ...);
+      return did_hit;
+    }
+
+    template <size_t... I>
+    inline bool occluded_each(const ray &r, float t_min, float t_max, std::index_sequence<I...>) const
+    {
+      return (std::get<I>(prims).occluded(r, t_min, t_max) || ...);
+    }
+
+    template <size_t... I>
+    inline bool bounds_each(aabb &box, std::index_sequence<I...>) const
+    {
+      bool bounded = true;
+      box = aabb();
+      aabb b;
+      ((bounded &= std::get<I>(prims).bounding_box(b), box.extend(b)), ...);
+      return bounded && size() > 0;
+    }
+
+    std::tuple<P...> prims; /* Owned objects. */
+};
+
+/// @brief Heap allocate a static world over objects, deducing its type.
+template <class... P>
+static_world<P...> *make_static_world(P &&... objects)
+{
+  return new static_world<P...>(std::move(objects)...);
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef STREAMH
+#define STREAMH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "vec3.h"
+#include "hitable.h"
+#include "util.h"
+#include "render.h"
+#include "threads.h"
+#include "output.h"
+
+#define BAND_ROWS_DEFAULT 16
+
+/// Scanline writer class
+/// Receives a frame one row at a time, top row first, and writes each row
+/// to disk straight away so no full image has to be kept in memory.
+class scanline_writer
+{
+  public:
+    virtual ~scanline_writer() {}
+    /// @brief Open the output and write the header.
+    virtual bool begin(const char *filename, int nX, int nY) = 0;
+    /// @brief Append the next row of nX linear pixels.
+    virtual bool write_row(const vec3 *row) = 0;
+    /// @brief Write the trailer and close the output.
+    virtual bool finish() = 0;
+
+  protected:
+    /// @brief Quantize a row of nX pixels into line, see rgb8_quantizer.
+    inline void quantize_row(const vec3 *row, int nX, int y, uint8_t *line) const
+    {
+      static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 rows are read as packed floats");
+      quantizer.row((const float *) row, 3 * size_t(nX), y, line);
+    }
+
+    rgb8_quantizer quantizer;
+};
+
+/// Streams the same ASCII P3 output as write_ppm.
+class ppm_stream_writer : public scanline_writer
+{
+  public:
+    ppm_stream_writer(): f(NULL), nX(0), rows(0) {}
+    virtual ~ppm_stream_writer() { if (f) fclose(f); }
+    virtual bool begin(const char *filename, int width, int height)
+    {
+      nX = width;
+      rows = 0;
+      line.resize(3 * width);
+      f = fopen(filename, "w");
+      return f && fprintf(f, "P3\n%d %d \n255\n", width, height) > 0;
+    }
+    virtual bool write_row(const vec3 *row)
+    {
+      quantize_row(row, nX, rows++, line.data());
+      text.clear();
+      format.append(line.data(), nX, text);
+      return fwrite(text.data(), 1, text.size(), f) == text.size();
+    }
+    virtual bool finish()
+    {
+      bool ok = fclose(f) == 0;
+      f = NULL;
+      return ok;
+    }
+
+  private:
+    FILE *f;
+    int nX;
+    int rows;                  /* Rows written so far. */
+    std::vector<uint8_t> line; /* Quantized row. */
+    ppm_formatter format;
+    std::string text;          /* Text of the row, reused. */
+};
+
+/// Streams an 8-bit RGB PNG. Each row goes out as its own IDAT chunk holding
+/// uncompressed ("stored") deflate blocks, so nothing is buffered beyond one
+/// row. The file is larger than a compressed PNG but any decoder reads it.
+class png_stream_writer : public scanline_writer
+{
+  public:
+    png_stream_writer(): f(NULL), nX(0), nY(0), rows(0), adler_a(1), adler_b(0) {}
+    virtual ~png_stream_writer() { if (f) fclose(f); }
+
+    virtual bool begin(const char *filename, int width, int height)
+    {
+      nX = width;
+      nY = height;
+      rows = 0;
+      f = fopen(filename, "wb");
+      if (!f)
+      {
+        return false;
+      }
+      static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+      fwrite(signature, 1, 8, f);
+      unsigned char ihdr[13];
+      put_u32(ihdr, width);
+      put_u32(ihdr + 4, height);
+      ihdr[8] = 8;   /// Bit depth
+      ihdr[9] = 2;   /// Color type RGB
+      ihdr[10] = 0;  /// Deflate
+      ihdr[11] = 0;  /// Adaptive filtering
+      ihdr[12] = 0;  /// No interlace
+      chunk("IHDR", ihdr, 13);
+      /// zlib header: deflate, 32K window, no preset dictionary.
+      static const unsigned char zlib_header[2] = {0x78, 0x01};
+      chunk("IDAT", zlib_header, 2);
+      line.resize(1 + 3 * width);
+      return !ferror(f);
+    }
+
+    virtual bool write_row(const vec3 *row)
+    {
+      line[0] = 0; /// Filter type None
+      quantize_row(row, nX, rows, line.data() + 1);
+      adler(line.data(), line.size());
+      rows++;
+
+      /// Wrap the row in stored blocks of at most 65535 bytes each.
+      std::vector<unsigned char> data;
+      size_t off = 0;
+      while (off < line.size())
+      {
+        size_t len = std::min(line.size() - off, size_t(65535));
+        bool last = rows == nY && off + len == line.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back(len & 0xff);
+        data.push_back(len >> 8);
+        data.push_back(~len & 0xff);
+        data.push_back((~len >> 8) & 0xff);
+        data.insert(data.end(), line.begin() + off, line.begin() + off + len);
+        off += len;
+      }
+      chunk("IDAT", data.data(), data.size());
+      return !ferror(f);
+    }
+
+    virtual bool finish()
+    {
+      unsigned char checksum[4];
+      put_u32(checksum, (adler_b << 16) | adler_a);
+      chunk("IDAT", checksum, 4);
+      chunk("IEND", NULL, 0);
+      bool ok = rows == nY && fclose(f) == 0;
+      f = NULL;
+      return ok;
+    }
+
+  private:
+    static void put_u32(unsigned char *p, uint32_t v)
+    {
+      p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+
+    static uint32_t crc32(uint32_t crc, const unsigned char *p, size_t len)
+    {
+      static uint32_t table[256];
+      static bool ready = false;
+      if (!ready)
+      {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+          uint32_t c = n;
+          for (int k = 0; k < 8; k++)
+          {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+          }
+          table[n] = c;
+        }
+        ready = true;
+      }
+      for (size_t k = 0; k < len; k++)
+      {
+        crc = table[(crc ^ p[k]) & 0xff] ^ (crc >> 8);
+      }
+      return crc;
+    }
+
+    /// Running Adler-32 of the uncompressed zlib payload.
+    void adler(const unsigned char *p, size_t len)
+    {
+      for (size_t k = 0; k < len; k++)
+      {
+        adler_a = (adler_a + p[k]) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+      }
+    }
+
+    void chunk(const char *type, const unsigned char *data, size_t len)
+    {
+      unsigned char head[8];
+      put_u32(head, len);
+      memcpy(head + 4, type, 4);
+      fwrite(head, 1, 8, f);
+      if (len)
+      {
+        fwrite(data, 1, len, f);
+      }
+      uint32_t crc = crc32(0xffffffffu, head + 4, 4);
+      crc = crc32(crc, data, len) ^ 0xffffffffu;
+      unsigned char tail[4];
+      put_u32(tail, crc);
+      fwrite(tail, 1, 4, f);
+    }
+
+    FILE *f;
+    int nX, nY;
+    int rows;                          /* Rows written so far. */
+    uint32_t adler_a, adler_b;         /* Adler-32 state. */
+    std::vector<unsigned char> line;   /* Filter byte plus one RGB8 row. */
+};
+
+/// @brief Pick a scanline writer from the output file extension.
+scanline_writer *make_scanline_writer(const std::string &filename)
+{
+  size_t dot = filename.rfind('.');
+  if (dot != std::string::npos && filename.substr(dot) == ".png")
+  {
+    return new png_stream_writer();
+  }
+  return new ppm_stream_writer();
+}
+
+/// @brief Render the frame in bands of rows, top first, writing each band
+/// as soon as it is done.
+///
+/// Two bands are resident at a time: while the calling thread writes one,
+/// the pool renders the next. Peak memory is 2 * band_rows * nX pixels
+/// regardless of the frame height.
+/// @param scn Scene to render.
+/// @param frame frame context
+/// @param writer opened scanline writer
+/// @param band_rows rows per band
+/// @return true iff every row was written.
+bool render_streaming(
+  const scene *scn,
+  const frame_ctx &frame,
+  scanline_writer &writer,
+  int band_rows)
+{
+  int nX = frame.nX, nY = frame.nY;
+  std::vector<vec3> bands[2];
+  bands[0].resize(band_rows * nX);
+  bands[1].resize(band_rows * nX);
+  task_group groups[2];
+
+  /// Band b covers frame rows (top - b * band_rows) downwards; row r of
+  /// the band buffer is frame row nY - 1 - (b * band_rows + r).
+  int band_count = (nY + band_rows - 1) / band_rows;
+  auto submit_band = [&](int b) {
+    vec3 *buf = bands[b % 2].data();
+    task_group *group = &groups[b % 2];
+    int first = b * band_rows;
+    int last = std::min(first + band_rows, nY);
+    group->add(last - first);
+    for (int r = first; r < last; r++)
+    {
+      shared_pool().submit([=, &frame] {
+        int j = nY - 1 - r;
+        render_row(scn, frame, j, 0, nX, buf + (r - first) * nX);
+        group->done();
+      });
+    }
+  };
+
+  bool ok = true;
+  submit_band(0);
+  for (int b = 0; b < band_count; b++)
+  {
+    groups[b % 2].wait();
+    if (b + 1 < band_count)
+    {
+      submit_band(b + 1);
+    }
+    int rows = std::min(band_rows, nY - b * band_rows);
+    for (int r = 0; r < rows && ok; r++)
+    {
+      ok = writer.write_row(bands[b % 2].data() + r * nX);
+    }
+    if (!ok)
+    {
+      break;
+    }
+  }
+  /// Drain a band still in flight if writing failed early.
+  groups[0].wait();
+  groups[1].wait();
+  return ok;
+}
+
+#endif
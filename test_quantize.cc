@@ -0,0 +1,71 @@
+/// Checks that the SSE2 rows of rgb8_quantizer match quantize() channel
+/// for channel, also for NaN, infinite, negative and huge inputs.
+/// Build and run with "make test".
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <limits>
+#include <vector>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "output.h"
+
+int main()
+{
+  const float special[] = {
+    0.0f, -0.0f, 1.0f, 0.5f, 0.999f, 1.001f, -1.0f, 1e-30f, FLT_MIN, 1e-45f,
+    std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(),
+    std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+    1e10f, 3e38f, FLT_MAX, -FLT_MAX, 2147483648.0f, 65025.0f
+  };
+  std::vector<float> row;
+  for (float c : special)
+  {
+    row.push_back(c);
+  }
+  /// Every 8-bit step and its neighbours.
+  for (int v = 0; v < 256; v++)
+  {
+    float c = (v / 255.99f) * (v / 255.99f);
+    row.push_back(nextafterf(c, 0));
+    row.push_back(c);
+    row.push_back(nextafterf(c, 2));
+  }
+  /// Lengths that are not a multiple of 16 also exercise the scalar tail.
+  int failures = 0;
+  rgb8_quantizer q(false);
+  for (size_t n = row.size() - 15; n <= row.size(); n++)
+  {
+    std::vector<uint8_t> out(n);
+    q.row(row.data(), n, 0, out.data());
+    for (size_t k = 0; k < n; k++)
+    {
+      if (out[k] != quantize(row[k]))
+      {
+        fprintf(stderr, "n %zu, channel %zu: %g gives %d, quantize %d\n", n, k, row[k], out[k], quantize(row[k]));
+        failures++;
+      }
+    }
+  }
+  /// Both paths on the special values, at the start of a row and in its tail.
+  for (size_t n : {size_t(16), size_t(3)})
+  {
+    for (size_t k = 0; k < sizeof(special) / sizeof(special[0]); k++)
+    {
+      std::vector<float> one(n, special[k]);
+      std::vector<uint8_t> out(n);
+      rgb8_quantizer(true).row(one.data(), n, 0, out.data());
+      /// Dithering only changes channels strictly between black and white.
+      int expect = special[k] > 0 && special[k] < 1 ? -1 : quantize(special[k]);
+      for (size_t i = 0; i < n; i++)
+      {
+        if (expect >= 0 && out[i] != expect)
+        {
+          fprintf(stderr, "dithered %g gives %d, expected %d\n", special[k], out[i], expect);
+          failures++;
+        }
+      }
+    }
+  }
+  printf("quantize: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
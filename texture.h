@@ -0,0 +1,505 @@
+#ifndef TEXTUREH
+#define TEXTUREH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "vec3.h"
+#include "stb_image.h"
+
+#define TEXTURE_TILE 64              /// Texels per tile side
+#define TEXTURE_BUDGET_DEFAULT 64    /// Resident tile memory, megabytes
+#define TEXTURE_BUDGET_MAX (1 << 20) /// Largest accepted budget, megabytes
+#define TEXTURE_MAGIC "RTTX"
+#define TEXTURE_VERSION 1
+
+/// Texture class
+/// Color of a surface as a function of its texture coordinates.
+class texture
+{
+  public:
+    virtual ~texture() {}
+    /// @param u horizontal texture coordinate, wraps around
+    /// @param v vertical texture coordinate, 0 at the top
+    /// @param duv filter width in texture coordinates
+    virtual vec3 value(float u, float v, float duv) const = 0;
+};
+
+/// Same color everywhere.
+class constant_texture : public texture
+{
+  public:
+    constant_texture(const vec3 &c): color(c) {}
+    virtual vec3 value(float u, float v, float duv) const { return color; }
+  private:
+    vec3 color;
+};
+
+/// Alternating squares of two colors.
+class checker_texture : public texture
+{
+  public:
+    checker_texture(const vec3 &a, const vec3 &b, int n): even(a), odd(b), squares(n) {}
+    virtual vec3 value(float u, float v, float duv) const
+    {
+      int x = int(floorf(u * 2 * squares)), y = int(floorf(v * squares));
+      return (x + y) & 1 ? odd : even;
+    }
+  private:
+    vec3 even, odd;
+    int squares;  /* Squares from top to bottom. */
+};
+
+/// Texture cache class
+/// Serves image textures from fixed size tiles of a mip pyramid, keeping at
+/// most a memory budget of tiles resident and evicting the least recently
+/// used. On first use an image is decoded once and converted into a tiled
+/// pyramid file in the cache directory; after that every tile is read from
+/// that file on demand, so only the tiles and levels actually sampled ever
+/// occupy memory.
+class texture_cache
+{
+  public:
+    typedef struct level_info
+    {
+      int width, height;   /// Texels
+      int tiles_x, tiles_y;
+      off_t offset;        /// Position of the level's first tile in the file
+    } level_info;
+
+    /// Registered image, handed out by add() as the handle for lookups.
+    typedef struct tex_file
+    {
+      std::string path;
+      int id;              /// Position in files, part of the tile keys
+      std::mutex mtx;      /// Guards opening and converting
+      std::atomic<bool> ready;
+      bool failed;
+      int fd;
+      int width, height, levels;
+      std::vector<level_info> level;
+      tex_file(const std::string &p, int i): path(p), id(i), ready(false), failed(false), fd(-1),
+        width(0), height(0), levels(0) {}
+    } tex_file;
+
+    texture_cache(size_t budget_bytes, const std::string &cache_dir):
+      budget(budget_bytes), dir(cache_dir), resident(0), peak(0),
+      requests(0), misses(0), bytes_read(0) {}
+    ~texture_cache()
+    {
+      for (size_t i = 0; i < files.size(); i++)
+      {
+        if (files[i]->fd >= 0)
+        {
+          close(files[i]->fd);
+        }
+      }
+    }
+
+    /// @brief Register an image file, nothing is read until it is sampled.
+    /// @return texture handle for lookup, valid for the cache's lifetime.
+    const tex_file *add(const std::string &path)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      for (size_t i = 0; i < files.size(); i++)
+      {
+        if (files[i]->path == path)
+        {
+          return files[i].get();
+        }
+      }
+      files.push_back(std::unique_ptr<tex_file>(new tex_file(path, files.size())));
+      return files.back().get();
+    }
+
+    /// @brief Bilinearly filtered linear color of a texture.
+    ///
+    /// The mip level is the one whose texels match the filter width duv.
+    vec3 lookup(const tex_file *handle, float u, float v, float duv)
+    {
+      tex_file *f = const_cast<tex_file *>(handle);
+      if (!open_file(f))
+      {
+        /// Missing textures show up magenta instead of failing the render.
+        return vec3(1, 0, 1);
+      }
+      float texels = std::max(duv * f->width, 1e-8f);
+      int level = std::min(f->levels - 1, std::max(0, int(floorf(log2f(texels)))));
+      int lw = std::max(1, f->width >> level), lh = std::max(1, f->height >> level);
+      float x = (u - floorf(u)) * lw - 0.5f, y = v * lh - 0.5f;
+      int x0 = int(floorf(x)), y0 = int(floorf(y));
+      float fx = x - x0, fy = y - y0;
+      vec3 c00 = texel(f, level, x0, y0), c10 = texel(f, level, x0 + 1, y0);
+      vec3 c01 = texel(f, level, x0, y0 + 1), c11 = texel(f, level, x0 + 1, y0 + 1);
+      return (1 - fy) * ((1 - fx) * c00 + fx * c10) + fy * ((1 - fx) * c01 + fx * c11);
+    }
+
+    /// @brief Print hit rate and memory use.
+    void report(FILE *out)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      size_t req = requests, miss = misses;
+      fprintf(out, "textures: %zu files, %zu tile requests, %.3f%% hit rate, "
+        "%zu tiles read (%.1f MB), %.1f MB resident, %.1f MB peak of %.1f MB budget\n",
+        files.size(), req, req ? 100.0 * (req - miss) / req : 100.0,
+        miss, bytes_read / 1048576.0, resident / 1048576.0, peak / 1048576.0, budget / 1048576.0);
+    }
+
+    /// @brief True once any texture has been sampled.
+    inline bool used() const { return requests > 0; }
+
+  private:
+    typedef std::vector<uint8_t> tile;
+
+    typedef struct file_header
+    {
+      char magic[4];
+      uint32_t version;
+      int32_t width, height, levels, tile;
+    } file_header;
+
+    /// Tile looked up last by the calling thread, saves a locked map lookup
+    /// for the common case of neighbouring texels in the same tile. It does
+    /// not keep the tile resident: once evicted, the next lookup fetches it.
+    typedef struct tile_memo
+    {
+      const texture_cache *owner;
+      uint64_t key;
+      std::weak_ptr<tile> data;
+    } tile_memo;
+
+    static inline uint64_t tile_key(int id, int level, int tx, int ty)
+    {
+      return (uint64_t(id) << 40) | (uint64_t(level) << 32) | (uint64_t(ty) << 16) | uint64_t(tx);
+    }
+
+    /// @brief Gamma 2 encoded byte to linear, the inverse of output quantize.
+    static inline float to_linear(uint8_t b)
+    {
+      static const std::vector<float> lut = [] {
+        std::vector<float> t(256);
+        for (int k = 0; k < 256; k++)
+        {
+          t[k] = (k / 255.0f) * (k / 255.0f);
+        }
+        return t;
+      }();
+      return lut[b];
+    }
+
+    /// @brief Texel (x, y) of a level, wrapping horizontally and clamping vertically.
+    vec3 texel(const tex_file *f, int level, int x, int y)
+    {
+      const level_info &l = f->level[level];
+      x %= l.width;
+      x += x < 0 ? l.width : 0;
+      y = std::min(l.height - 1, std::max(0, y));
+      uint64_t key = tile_key(f->id, level, x / TEXTURE_TILE, y / TEXTURE_TILE);
+      static thread_local tile_memo memo = {NULL, 0, std::weak_ptr<tile>()};
+      requests.fetch_add(1, std::memory_order_relaxed);
+      /// Held only while the texel is read, so evictions free tiles at once.
+      std::shared_ptr<tile> data;
+      if (memo.owner == this && memo.key == key)
+      {
+        data = memo.data.lock();
+      }
+      if (!data)
+      {
+        data = fetch(f, key, level, x / TEXTURE_TILE, y / TEXTURE_TILE);
+        memo.owner = this;
+        memo.key = key;
+        memo.data = data;
+      }
+      const uint8_t *p = &(*data)[3 * ((y % TEXTURE_TILE) * TEXTURE_TILE + x % TEXTURE_TILE)];
+      return vec3(to_linear(p[0]), to_linear(p[1]), to_linear(p[2]));
+    }
+
+    /// @brief Resident tile for key, read from the pyramid file on a miss.
+    std::shared_ptr<tile> fetch(const tex_file *f, uint64_t key, int level, int tx, int ty)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::unordered_map<uint64_t, lru_entry>::iterator it = tiles.find(key);
+        if (it != tiles.end())
+        {
+          order.splice(order.begin(), order, it->second.pos);
+          return it->second.data;
+        }
+        misses++;
+      }
+      /// Read without holding the lock, other threads keep hitting.
+      const level_info &l = f->level[level];
+      const size_t tile_bytes = 3 * TEXTURE_TILE * TEXTURE_TILE;
+      std::shared_ptr<tile> data = std::make_shared<tile>(tile_bytes);
+      off_t at = l.offset + off_t(ty * l.tiles_x + tx) * tile_bytes;
+      if (pread(f->fd, data->data(), tile_bytes, at) != ssize_t(tile_bytes))
+      {
+        std::fill(data->begin(), data->end(), 0);
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      bytes_read += tile_bytes;
+      std::unordered_map<uint64_t, lru_entry>::iterator it = tiles.find(key);
+      if (it != tiles.end())
+      {
+        /// Another thread loaded it meanwhile.
+        return it->second.data;
+      }
+      order.push_front(key);
+      tiles[key] = lru_entry{data, order.begin()};
+      resident += tile_bytes;
+      /// Evict from the cold end, never the tile just loaded.
+      while (resident > budget && order.size() > 1)
+      {
+        tiles.erase(order.back());
+        order.pop_back();
+        resident -= tile_bytes;
+      }
+      peak = std::max(peak, resident);
+      return data;
+    }
+
+    /// @brief Make the pyramid file of f available, converting it if needed.
+    /// @return false if the texture cannot be used.
+    bool open_file(tex_file *f)
+    {
+      if (f->ready)
+      {
+        return true;
+      }
+      std::lock_guard<std::mutex> lock(f->mtx);
+      if (f->ready || f->failed)
+      {
+        return f->ready;
+      }
+      std::string cached = cache_path(f->path);
+      int fd = ::open(cached.c_str(), O_RDONLY);
+      if (fd < 0 && convert(f->path, cached))
+      {
+        fd = ::open(cached.c_str(), O_RDONLY);
+      }
+      file_header h;
+      if (fd < 0 || pread(fd, &h, sizeof(h), 0) != ssize_t(sizeof(h))
+          || memcmp(h.magic, TEXTURE_MAGIC, 4) != 0 || h.version != TEXTURE_VERSION
+          || h.tile != TEXTURE_TILE)
+      {
+        fprintf(stderr, "Cannot use texture %s\n", f->path.c_str());
+        if (fd >= 0)
+        {
+          close(fd);
+        }
+        f->failed = true;
+        return false;
+      }
+      f->fd = fd;
+      f->width = h.width;
+      f->height = h.height;
+      f->levels = h.levels;
+      f->level = level_layout(h.width, h.height, h.levels);
+      f->ready = true;
+      return true;
+    }
+
+    /// @brief Size and file position of every level of a pyramid.
+    static std::vector<level_info> level_layout(int width, int height, int levels)
+    {
+      std::vector<level_info> res(levels);
+      off_t offset = sizeof(file_header);
+      for (int l = 0; l < levels; l++)
+      {
+        level_info &li = res[l];
+        li.width = std::max(1, width >> l);
+        li.height = std::max(1, height >> l);
+        li.tiles_x = (li.width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        li.tiles_y = (li.height + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        li.offset = offset;
+        offset += off_t(li.tiles_x) * li.tiles_y * 3 * TEXTURE_TILE * TEXTURE_TILE;
+      }
+      return res;
+    }
+
+    /// @brief Cache file name, changes whenever the source file does.
+    std::string cache_path(const std::string &path) const
+    {
+      struct stat st;
+      uint64_t h = 1469598103934665603ull;
+      std::string id = path;
+      if (stat(path.c_str(), &st) == 0)
+      {
+        id += ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+      }
+      for (size_t k = 0; k < id.size(); k++)
+      {
+        h = (h ^ uint8_t(id[k])) * 1099511628211ull;
+      }
+      char name[32];
+      snprintf(name, sizeof(name), "%016llx.rttx", (unsigned long long) h);
+      return dir + "/" + name;
+    }
+
+    /// @brief Decode an image and write its tiled mip pyramid to out.
+    ///
+    /// Levels are box filtered in linear space. The file is written under a
+    /// temporary name and renamed, so concurrent renders never see half of it.
+    bool convert(const std::string &path, const std::string &out) const
+    {
+      int width, height, n;
+      uint8_t *pixels = stbi_load(path.c_str(), &width, &height, &n, 3);
+      if (!pixels)
+      {
+        fprintf(stderr, "Cannot load texture %s: %s\n", path.c_str(), stbi_failure_reason());
+        return false;
+      }
+      int levels = 1;
+      while ((width >> levels) > 0 || (height >> levels) > 0)
+      {
+        levels++;
+      }
+      std::vector<level_info> layout = level_layout(width, height, levels);
+      mkdir(dir.c_str(), 0755);
+      std::string tmp = out + ".tmp" + std::to_string(getpid());
+      FILE *fp = fopen(tmp.c_str(), "wb");
+      if (!fp)
+      {
+        stbi_image_free(pixels);
+        return false;
+      }
+      file_header h;
+      memcpy(h.magic, TEXTURE_MAGIC, 4);
+      h.version = TEXTURE_VERSION;
+      h.width = width;
+      h.height = height;
+      h.levels = levels;
+      h.tile = TEXTURE_TILE;
+      bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+      std::vector<float> img(pixels, pixels + 3 * width * height);
+      stbi_image_free(pixels);
+      for (size_t k = 0; k < img.size(); k++)
+      {
+        img[k] = to_linear(uint8_t(img[k]));
+      }
+      std::vector<uint8_t> t(3 * TEXTURE_TILE * TEXTURE_TILE);
+      for (int l = 0; l < levels && ok; l++)
+      {
+        const level_info &li = layout[l];
+        if (l > 0)
+        {
+          /// Average 2x2 blocks of the previous level, clamped at the edges.
+          const level_info &prev = layout[l - 1];
+          std::vector<float> next(3 * li.width * li.height);
+          for (int y = 0; y < li.height; y++)
+          {
+            for (int x = 0; x < li.width; x++)
+            {
+              for (int c = 0; c < 3; c++)
+              {
+                float sum = 0;
+                for (int k = 0; k < 4; k++)
+                {
+                  int sx = std::min(prev.width - 1, 2 * x + (k & 1));
+                  int sy = std::min(prev.height - 1, 2 * y + (k >> 1));
+                  sum += img[3 * (sy * prev.width + sx) + c];
+                }
+                next[3 * (y * li.width + x) + c] = sum / 4;
+              }
+            }
+          }
+          img.swap(next);
+        }
+        for (int ty = 0; ty < li.tiles_y && ok; ty++)
+        {
+          for (int tx = 0; tx < li.tiles_x && ok; tx++)
+          {
+            /// Edge tiles are padded to full size, keeping offsets simple.
+            std::fill(t.begin(), t.end(), 0);
+            for (int y = 0; y < TEXTURE_TILE && ty * TEXTURE_TILE + y < li.height; y++)
+            {
+              for (int x = 0; x < TEXTURE_TILE && tx * TEXTURE_TILE + x < li.width; x++)
+              {
+                const float *p = &img[3 * ((ty * TEXTURE_TILE + y) * li.width + tx * TEXTURE_TILE + x)];
+                for (int c = 0; c < 3; c++)
+                {
+                  t[3 * (y * TEXTURE_TILE + x) + c] = std::min(255, int(255.99 * sqrt(p[c])));
+                }
+              }
+            }
+            ok = fwrite(t.data(), t.size(), 1, fp) == 1;
+          }
+        }
+      }
+      ok = fclose(fp) == 0 && ok;
+      if (!ok || rename(tmp.c_str(), out.c_str()) != 0)
+      {
+        remove(tmp.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    typedef struct lru_entry
+    {
+      std::shared_ptr<tile> data;
+      std::list<uint64_t>::iterator pos;
+    } lru_entry;
+
+    size_t budget;                      /* Maximum resident tile bytes. */
+    std::string dir;                    /* Where pyramid files are kept. */
+    std::mutex mtx;                     /* Guards files, tiles, order and counters below. */
+    std::vector<std::unique_ptr<tex_file>> files;
+    std::unordered_map<uint64_t, lru_entry> tiles;
+    std::list<uint64_t> order;          /* Tile keys, most recently used first. */
+    size_t resident, peak;              /* Resident tile bytes, now and at most. */
+    std::atomic<size_t> requests;       /* Texel fetches, memo hits included. */
+    size_t misses;                      /* Fetches that had to read a tile. */
+    size_t bytes_read;
+};
+
+/// Resident tile budget of the shared texture cache, in megabytes.
+/// Must be set before the first call to shared_textures().
+static size_t texture_budget_mb = TEXTURE_BUDGET_DEFAULT;
+
+/// @brief Process wide texture cache, created on first use. Pyramid files
+/// go to $TMPDIR/rt-textures.
+inline texture_cache &shared_textures()
+{
+  static texture_cache cache(texture_budget_mb << 20,
+    std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + "/rt-textures");
+  return cache;
+}
+
+/// @brief Print shared texture cache statistics to stderr, if any texture was sampled.
+void report_textures()
+{
+  texture_cache &cache = shared_textures();
+  if (cache.used())
+  {
+    cache.report(stderr);
+  }
+}
+
+/// Image texture served by the shared texture cache.
+class image_texture : public texture
+{
+  public:
+    image_texture(const std::string &path): handle(shared_textures().add(path)) {}
+    virtual vec3 value(float u, float v, float duv) const
+    {
+      return shared_textures().lookup(handle, u, v, duv);
+    }
+  private:
+    const texture_cache::tex_file *handle;  /* Texture in the shared cache. */
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef THREADSH
+#define THREADSH
+
+#include <stdint.h>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/// Thread pool class
+/// A fixed set of worker threads pulling tasks from a shared priority queue.
+/// Higher priority tasks run first; equal priorities run in submission order.
+class thread_pool
+{
+  public:
+    /// @brief Start n workers, or one per hardware thread if n <= 0.
+    thread_pool(int n = 0): stopping(false), order(0)
+    {
+      if (n <= 0)
+      {
+        n = std::thread::hardware_concurrency();
+      }
+      if (n <= 0)
+      {
+        n = 1;
+      }
+      for (int i = 0; i < n; i++)
+      {
+        workers.push_back(std::thread(&thread_pool::work, this));
+      }
+    }
+
+    /// Drain the queue and join all workers.
+    ~thread_pool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+      }
+      cv.notify_all();
+      for (size_t i = 0; i < workers.size(); i++)
+      {
+        workers[i].join();
+      }
+    }
+
+    /// @brief Queue a task.
+    /// @param fn task body
+    /// @param priority larger values are scheduled first
+    void submit(std::function<void()> fn, int priority = 0)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        tasks.push(task{priority, order++, fn});
+      }
+      cv.notify_one();
+    }
+
+    inline int size() const { return workers.size(); }
+
+  private:
+    typedef struct task
+    {
+      int priority;
+      uint64_t order;
+      std::function<void()> fn;
+      bool operator<(const task &o) const
+      {
+        /// std::priority_queue pops the largest element.
+        if (priority != o.priority) return priority < o.priority;
+        return order > o.order;
+      }
+    } task;
+
+    /// Worker loop: pop the most urgent task and run it.
+    void work()
+    {
+      for (;;)
+      {
+        task t;
+        {
+          std::unique_lock<std::mutex> lock(mtx);
+          cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+          if (tasks.empty())
+          {
+            return;
+          }
+          t = tasks.top();
+          tasks.pop();
+        }
+        t.fn();
+      }
+    }
+
+    std::vector<std::thread> workers;
+    std::priority_queue<task> tasks;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping;   /* Set once the pool is being destroyed. */
+    uint64_t order;  /* Submission counter, keeps FIFO order within a priority. */
+};
+
+/// Task group class
+/// Counts outstanding tasks so a caller can block until a batch finishes.
+class task_group
+{
+  public:
+    task_group(): pending(0) {}
+    void add(int n = 1)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pending += n;
+    }
+    /// Mark one task finished, waking waiters on the last one.
+    void done()
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (--pending == 0)
+      {
+        cv.notify_all();
+      }
+    }
+    /// Block until every added task called done().
+    void wait()
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this] { return pending == 0; });
+    }
+
+  private:
+    int pending;  /* Tasks added but not yet done, guarded by mtx. */
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+/// Worker count for the shared pool, 0 picks the hardware thread count.
+/// Must be set before the first call to shared_pool().
+static int pool_threads = 0;
+
+/// @brief Process wide render pool, created on first use.
+inline thread_pool &shared_pool()
+{
+  static thread_pool pool(pool_threads);
+  return pool;
+}
+
+#endif
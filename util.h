@@ -1,6 +1,10 @@
 #ifndef UTILH
 #define UTILH
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
 #include "vec3.h"
 #include "camera.h"
 #include "assert.h"
@@ -8,6 +12,8 @@
 #define IMG_RES 360
 #define WIDESCREEN 16.0 / 9.0
 #define IMG_HEIGHT IMG_RES
+#define MAX_RESOLUTION 16384  /// Largest accepted width or height
+#define MAX_SAMPLES (1 << 20) /// Largest accepted samples per pixel
 #define IMG_WIDTH IMG_HEIGHT * WIDESCREEN
 #define IMG_SAMPLES 50
 #define WORLD_SIZE 1
@@ -45,15 +51,64 @@
 #   define ASSERT(condition, message) do { } while (false)
 #endif
 
+/// Camera placement, kept next to the camera so a frame can be rebuilt
+/// elsewhere (e.g. by a render daemon) from plain values.
+typedef struct view_params
+{
+  vec3 lookfrom; /// Camera origin
+  vec3 lookat;   /// Point the camera focuses on
+  vec3 vup;      /// "up" vector defining camera rotation
+  float vfov;    /// Vertical field of vision in angles
+} view_params;
+
 /// Configuration for image frame
 typedef struct frame_ctx
 {
   camera cam;
+  view_params view; /// Parameters cam was built from
   size_t nX; /// horizontal frame resolution
   size_t nY; /// vertical frame resolution
   size_t nS; /// Anti-aliasing sample size
+  uint32_t seed; /// Seed for per-sample random streams
+  int sampling;  /// sampler_type drawing the per-sample streams
+  float shutter; /// Fraction of the frame interval the shutter is open, 0 for none
 } frame_ctx;
 
+/// @brief Rebuild the frame camera from its view parameters and resolution.
+void setup_camera(frame_ctx &frame)
+{
+  frame.cam = camera(
+    frame.view.lookfrom,
+    frame.view.lookat,
+    frame.view.vup,
+    frame.view.vfov,
+    float(frame.nX) / float(frame.nY));
+}
+
+/// @brief Parse a whole decimal number in [1, max].
+/// @param value (OUT) set only on success
+/// @return false for trailing text, overflow or values out of range.
+template <class T>
+bool parse_count(const char *str, long max, T &value)
+{
+  char *end;
+  errno = 0;
+  long v = strtol(str, &end, 10);
+  if (end == str || *end != '\0' || errno == ERANGE || v <= 0 || v > max)
+  {
+    return false;
+  }
+  value = T(v);
+  return true;
+}
+
+/// @brief Parse a vector written as "x,y,z".
+/// @return true iff all three components were read.
+bool parse_vec3(const char *str, vec3 &v)
+{
+  return sscanf(str, "%f,%f,%f", &v.e[0], &v.e[1], &v.e[2]) == 3;
+}
+
 /// Polynomial approximation for reflection probability.
 float schlick(float cosine, float ref_idx)
 {